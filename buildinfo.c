@@ -0,0 +1,681 @@
+/*
+ * buildinfo.c
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "buildinfo.h"
+#include "obsfs.h"
+#include "util.h"
+#include "http.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <expat.h>
+
+#define DEBUG_BUILDINFO
+
+#ifdef DEBUG_BUILDINFO
+#define DEBUG(x...) LOG(LOG_XML, LEVEL_DEBUG, x)
+#else
+#define DEBUG(x...)
+#endif
+
+typedef struct {
+  char *project;
+  barch_t *archs;
+  time_t timestamp;	/* time of the last _result request */
+  UT_hash_handle hh;
+} bproject_t;
+
+static bproject_t *project_hash = NULL;
+/* protects the snapshot data */
+static pthread_mutex_t buildinfo_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* One of these is held per project while talking to the server about it,
+   so we don't ask the same question twice; they only exist while somebody
+   uses them. */
+typedef struct {
+  char *project;
+  pthread_mutex_t mutex;
+  int users;
+  UT_hash_handle hh;
+} fetch_lock_t;
+
+static fetch_lock_t *fetch_locks = NULL;
+
+/* handed out for packages that have no binaries */
+static bbin_t no_binaries;
+
+static void free_binaries(bbin_t **binaries)
+{
+  bbin_t *bb, *tmp;
+  int i;
+  HASH_ITER(hh, *binaries, bb, tmp) {
+    HASH_DEL(*binaries, bb);
+    for (i = 0; i < bb->num_binaries; i++)
+      free(bb->binaries[i].name);
+    free(bb->binaries);
+    free(bb->package);
+    free(bb);
+  }
+}
+
+static void free_archs(barch_t **archs)
+{
+  barch_t *ba, *tmp;
+  bpkg_t *bp, *ptmp;
+  HASH_ITER(hh, *archs, ba, tmp) {
+    HASH_DEL(*archs, ba);
+    HASH_ITER(hh, ba->packages, bp, ptmp) {
+      HASH_DEL(ba->packages, bp);
+      free(bp->package);
+      free(bp->code);
+      free(bp->details);
+      free(bp);
+    }
+    free_binaries(&ba->binaries);
+    free(ba->key);
+    free(ba->repo);
+    free(ba->arch);
+    free(ba->code);
+    free(ba);
+  }
+}
+
+void buildinfo_free(void)
+{
+  bproject_t *bpr, *tmp;
+  pthread_mutex_lock(&buildinfo_mutex);
+  HASH_ITER(hh, project_hash, bpr, tmp) {
+    HASH_DEL(project_hash, bpr);
+    free_archs(&bpr->archs);
+    free(bpr->project);
+    free(bpr);
+  }
+  pthread_mutex_unlock(&buildinfo_mutex);
+}
+
+static bproject_t *find_project(const char *project)
+{
+  bproject_t *bpr;
+  HASH_FIND_STR(project_hash, project, bpr);
+  return bpr;
+}
+
+/* take the fetch lock of "project" */
+static fetch_lock_t *lock_fetch(const char *project)
+{
+  fetch_lock_t *fl;
+  pthread_mutex_lock(&buildinfo_mutex);
+  HASH_FIND_STR(fetch_locks, project, fl);
+  if (!fl) {
+    fl = calloc(1, sizeof(fetch_lock_t));
+    fl->project = strdup(project);
+    pthread_mutex_init(&fl->mutex, NULL);
+    HASH_ADD_KEYPTR(hh, fetch_locks, fl->project, strlen(fl->project), fl);
+  }
+  fl->users++;
+  pthread_mutex_unlock(&buildinfo_mutex);
+  pthread_mutex_lock(&fl->mutex);
+  return fl;
+}
+
+static void unlock_fetch(fetch_lock_t *fl)
+{
+  pthread_mutex_unlock(&fl->mutex);
+  pthread_mutex_lock(&buildinfo_mutex);
+  if (!--fl->users) {
+    HASH_DEL(fetch_locks, fl);
+    pthread_mutex_destroy(&fl->mutex);
+    free(fl->project);
+    free(fl);
+  }
+  pthread_mutex_unlock(&buildinfo_mutex);
+}
+
+static barch_t *find_arch(bproject_t *bpr, const char *repo, const char *arch)
+{
+  barch_t *ba;
+  char *key = malloc(strlen(repo) + 1 + strlen(arch) + 1);
+  sprintf(key, "%s/%s", repo, arch);
+  HASH_FIND_STR(bpr->archs, key, ba);
+  free(key);
+  return ba;
+}
+
+/* state of the _result parser */
+struct result_parse {
+  barch_t *archs;
+  barch_t *cur_arch;
+  bpkg_t *cur_pkg;
+  int in_details;
+};
+
+static void expat_result_start(void *ud, const XML_Char *name, const XML_Char **atts)
+{
+  struct result_parse *rp = (struct result_parse *)ud;
+  if (!strcmp(name, "result")) {
+    const char *repo = NULL, *arch = NULL, *code = NULL;
+    for (; *atts; atts += 2) {
+      if (!strcmp(atts[0], "repository"))
+        repo = atts[1];
+      else if (!strcmp(atts[0], "arch"))
+        arch = atts[1];
+      else if (!strcmp(atts[0], "code"))
+        code = atts[1];
+    }
+    if (!repo || !arch)
+      return;
+    barch_t *ba = calloc(1, sizeof(barch_t));
+    ba->repo = strdup(repo);
+    ba->arch = strdup(arch);
+    ba->code = strdup(code ? : "unknown");
+    ba->key = malloc(strlen(repo) + 1 + strlen(arch) + 1);
+    sprintf(ba->key, "%s/%s", repo, arch);
+    HASH_ADD_KEYPTR(hh, rp->archs, ba->key, strlen(ba->key), ba);
+    rp->cur_arch = ba;
+  }
+  else if (!strcmp(name, "status") && rp->cur_arch) {
+    const char *package = NULL, *code = NULL;
+    for (; *atts; atts += 2) {
+      if (!strcmp(atts[0], "package"))
+        package = atts[1];
+      else if (!strcmp(atts[0], "code"))
+        code = atts[1];
+    }
+    if (!package)
+      return;
+    bpkg_t *bp = calloc(1, sizeof(bpkg_t));
+    bp->package = strdup(package);
+    bp->code = strdup(code ? : "unknown");
+    HASH_ADD_KEYPTR(hh, rp->cur_arch->packages, bp->package, strlen(bp->package), bp);
+    rp->cur_pkg = bp;
+  }
+  else if (!strcmp(name, "details") && rp->cur_pkg) {
+    rp->in_details = 1;
+  }
+}
+
+static void expat_result_end(void *ud, const XML_Char *name)
+{
+  struct result_parse *rp = (struct result_parse *)ud;
+  if (!strcmp(name, "details"))
+    rp->in_details = 0;
+  else if (!strcmp(name, "status"))
+    rp->cur_pkg = NULL;
+  else if (!strcmp(name, "result"))
+    rp->cur_arch = NULL;
+}
+
+static void expat_result_data(void *ud, const XML_Char *s, int len)
+{
+  struct result_parse *rp = (struct result_parse *)ud;
+  if (!rp->in_details)
+    return;
+  bpkg_t *bp = rp->cur_pkg;
+  size_t old = bp->details ? strlen(bp->details) : 0;
+  bp->details = realloc(bp->details, old + len + 1);
+  memcpy(bp->details + old, s, len);
+  bp->details[old + len] = 0;
+}
+
+static size_t parse_write(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+  XML_Parse((XML_Parser)userdata, ptr, size * nmemb, 0);
+  return size * nmemb;
+}
+
+/* GET "api_path" and feed it to "xp"; returns 0 on success */
+static int fetch_xml(const char *api_path, XML_Parser xp)
+{
+  char *url = make_url(url_prefix, api_path, NULL);
+  long code = 0;
+  DEBUG("BUILDINFO: getting %s\n", api_path);
+  CURL *curl = curl_open_file(url, NULL, NULL, parse_write, xp);
+  CURLcode ret = http_perform(curl);
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+  http_close(curl);
+  free(url);
+  if (ret || code != 200) {
+    LOG(LOG_XML, LEVEL_ERROR, "BUILDINFO: getting %s failed (curl %d, HTTP %ld)\n", api_path, ret, code);
+    return -1;
+  }
+  return XML_Parse(xp, NULL, 0, 1) == XML_STATUS_OK ? 0 : -1;
+}
+
+/* get the build results of all packages of "project", unless we have
+   recent ones already; returns 0 on success */
+int buildinfo_result(const char *project)
+{
+  bproject_t *bpr;
+  struct result_parse rp;
+  int ret = 0;
+  
+  fetch_lock_t *fl = lock_fetch(project);
+  pthread_mutex_lock(&buildinfo_mutex);
+  bpr = find_project(project);
+  if (bpr && time(NULL) - bpr->timestamp <= DIR_CACHE_TIMEOUT) {
+    pthread_mutex_unlock(&buildinfo_mutex);
+    unlock_fetch(fl);
+    return 0;
+  }
+  pthread_mutex_unlock(&buildinfo_mutex);
+  
+  memset(&rp, 0, sizeof(rp));
+  XML_Parser xp = XML_ParserCreate(NULL);
+  if (!xp)
+    abort();
+  XML_SetUserData(xp, (void *)&rp);
+  XML_SetElementHandler(xp, expat_result_start, expat_result_end);
+  XML_SetCharacterDataHandler(xp, expat_result_data);
+  char *api_path = malloc(strlen("/build//_result") + strlen(project) + 1);
+  sprintf(api_path, "/build/%s/_result", project);
+  ret = fetch_xml(api_path, xp);
+  free(api_path);
+  XML_ParserFree(xp);
+  
+  pthread_mutex_lock(&buildinfo_mutex);
+  if (!ret) {
+    bpr = find_project(project);
+    if (!bpr) {
+      bpr = calloc(1, sizeof(bproject_t));
+      bpr->project = strdup(project);
+      HASH_ADD_KEYPTR(hh, project_hash, bpr->project, strlen(bpr->project), bpr);
+    }
+    /* the binaries don't come with _result, keep those we have */
+    barch_t *ba, *tmp, *old;
+    HASH_ITER(hh, rp.archs, ba, tmp) {
+      HASH_FIND_STR(bpr->archs, ba->key, old);
+      if (old) {
+        ba->binaries = old->binaries;
+        ba->bin_timestamp = old->bin_timestamp;
+        old->binaries = NULL;
+      }
+    }
+    free_archs(&bpr->archs);
+    bpr->archs = rp.archs;
+    bpr->timestamp = time(NULL);
+  }
+  else
+    free_archs(&rp.archs);
+  pthread_mutex_unlock(&buildinfo_mutex);
+  unlock_fetch(fl);
+  return ret;
+}
+
+/* the build results of "project" have changed, ask again next time */
+void buildinfo_invalidate(const char *project)
+{
+  bproject_t *bpr;
+  barch_t *ba, *tmp;
+  pthread_mutex_lock(&buildinfo_mutex);
+  if ((bpr = find_project(project))) {
+    bpr->timestamp = 0;
+    HASH_ITER(hh, bpr->archs, ba, tmp)
+      ba->bin_timestamp = 0;
+  }
+  pthread_mutex_unlock(&buildinfo_mutex);
+}
+
+/* state of the binaryversions parser */
+struct binaries_parse {
+  bbin_t *binaries;
+  bbin_t *cur;
+};
+
+static void expat_binaries_start(void *ud, const XML_Char *name, const XML_Char **atts)
+{
+  struct binaries_parse *bp = (struct binaries_parse *)ud;
+  if (!strcmp(name, "binaryversionlist")) {
+    bp->cur = NULL;
+    for (; *atts; atts += 2) {
+      if (!strcmp(atts[0], "package")) {
+        bp->cur = calloc(1, sizeof(bbin_t));
+        bp->cur->package = strdup(atts[1]);
+        HASH_ADD_KEYPTR(hh, bp->binaries, bp->cur->package, strlen(bp->cur->package), bp->cur);
+      }
+    }
+  }
+  else if (!strcmp(name, "binary") && bp->cur) {
+    const char *bname = NULL;
+    off_t size = 0;
+    for (; *atts; atts += 2) {
+      if (!strcmp(atts[0], "name"))
+        bname = atts[1];
+      else if (!strcmp(atts[0], "sizek"))
+        size = (off_t)atoll(atts[1]) * 1024;	/* rounded up, better than too small */
+    }
+    if (!bname)
+      return;
+    bbin_t *bb = bp->cur;
+    bb->binaries = realloc(bb->binaries, (bb->num_binaries + 1) * sizeof(binary_t));
+    bb->binaries[bb->num_binaries].name = strdup(bname);
+    bb->binaries[bb->num_binaries].size = size;
+    bb->num_binaries++;
+  }
+}
+
+/* get the binaries of all packages in a repository, unless we have them
+   already; the build results must have been retrieved first */
+int buildinfo_binaries(const char *project, const char *repo, const char *arch)
+{
+  bproject_t *bpr;
+  barch_t *ba;
+  struct binaries_parse bp;
+  int ret;
+  
+  fetch_lock_t *fl = lock_fetch(project);
+  pthread_mutex_lock(&buildinfo_mutex);
+  if (!(bpr = find_project(project)) || !(ba = find_arch(bpr, repo, arch))) {
+    pthread_mutex_unlock(&buildinfo_mutex);
+    unlock_fetch(fl);
+    return -1;
+  }
+  if (ba->bin_timestamp && time(NULL) - ba->bin_timestamp <= DIR_CACHE_TIMEOUT) {
+    pthread_mutex_unlock(&buildinfo_mutex);
+    unlock_fetch(fl);
+    return 0;
+  }
+  pthread_mutex_unlock(&buildinfo_mutex);
+  
+  memset(&bp, 0, sizeof(bp));
+  XML_Parser xp = XML_ParserCreate(NULL);
+  if (!xp)
+    abort();
+  XML_SetUserData(xp, (void *)&bp);
+  XML_SetElementHandler(xp, expat_binaries_start, NULL);
+  char *api_path = malloc(strlen("/build////?view=binaryversions") + strlen(project) + strlen(repo) + strlen(arch) + 1);
+  sprintf(api_path, "/build/%s/%s/%s?view=binaryversions", project, repo, arch);
+  ret = fetch_xml(api_path, xp);
+  free(api_path);
+  XML_ParserFree(xp);
+  
+  pthread_mutex_lock(&buildinfo_mutex);
+  /* the project may have been refreshed in the meantime */
+  if (!ret && (bpr = find_project(project)) && (ba = find_arch(bpr, repo, arch))) {
+    free_binaries(&ba->binaries);
+    ba->binaries = bp.binaries;
+    ba->bin_timestamp = time(NULL);
+  }
+  else {
+    free_binaries(&bp.binaries);
+    ret = -1;
+  }
+  pthread_mutex_unlock(&buildinfo_mutex);
+  unlock_fetch(fl);
+  return ret;
+}
+
+/* call "fn" for every repository/architecture of "project"; returns -1 if
+   there is no snapshot for the project */
+int buildinfo_foreach_arch(const char *project, void (*fn)(barch_t *ba, void *userdata), void *userdata)
+{
+  bproject_t *bpr;
+  barch_t *ba, *tmp;
+  pthread_mutex_lock(&buildinfo_mutex);
+  if (!(bpr = find_project(project))) {
+    pthread_mutex_unlock(&buildinfo_mutex);
+    return -1;
+  }
+  HASH_ITER(hh, bpr->archs, ba, tmp) {
+    fn(ba, userdata);
+  }
+  pthread_mutex_unlock(&buildinfo_mutex);
+  return 0;
+}
+
+/* call "fn" for "package" (or all packages, if NULL) in a repository;
+   "fn" gets NULL for the binaries if we don't know them; returns the number
+   of packages, or -1 if there is no (fresh) snapshot */
+int buildinfo_foreach(const char *project, const char *repo, const char *arch, const char *package,
+                      bpkg_fn fn, void *userdata)
+{
+  bproject_t *bpr;
+  barch_t *ba;
+  bpkg_t *bp, *tmp;
+  bbin_t *bb;
+  int n = 0;
+  
+  pthread_mutex_lock(&buildinfo_mutex);
+  if (!(bpr = find_project(project)) || time(NULL) - bpr->timestamp > DIR_CACHE_TIMEOUT ||
+      !(ba = find_arch(bpr, repo, arch))) {
+    pthread_mutex_unlock(&buildinfo_mutex);
+    return -1;
+  }
+  HASH_ITER(hh, ba->packages, bp, tmp) {
+    if (package && strcmp(package, bp->package))
+      continue;
+    HASH_FIND_STR(ba->binaries, bp->package, bb);
+    if (!bb && ba->bin_timestamp)
+      bb = &no_binaries;
+    fn(ba, bp, bb, userdata);
+    n++;
+  }
+  pthread_mutex_unlock(&buildinfo_mutex);
+  return n;
+}
+
+static void write_status(barch_t *ba, bpkg_t *bp, bbin_t *bb, void *userdata)
+{
+  FILE *fp = (FILE *)userdata;
+  fprintf(fp, "<status package=\"");
+  xml_escape(fp, bp->package);
+  fprintf(fp, "\" code=\"");
+  xml_escape(fp, bp->code);
+  fprintf(fp, "\">\n");
+  if (bp->details) {
+    fprintf(fp, "  <details>");
+    xml_escape(fp, bp->details);
+    fprintf(fp, "</details>\n");
+  }
+  else
+    fprintf(fp, "  <details/>\n");
+  fprintf(fp, "</status>\n");
+}
+
+/* write the _status document of a package from the snapshot; returns -1 if
+   the snapshot can't tell */
+int buildinfo_status(const char *project, const char *repo, const char *arch, const char *package, FILE *fp)
+{
+  return buildinfo_foreach(project, repo, arch, package, write_status, fp) > 0 ? 0 : -1;
+}
+
+static void check_finished(barch_t *ba, bpkg_t *bp, bbin_t *bb, void *userdata)
+{
+  static const char *final_codes[] = {
+    "succeeded", "failed", "unresolvable", "broken", "disabled", "excluded", NULL
+  };
+  const char **c;
+  for (c = final_codes; *c; c++) {
+    if (!strcmp(bp->code, *c))
+      *(int *)userdata = 1;
+  }
+}
+
+/* whether the snapshot says that the package is done building, so that
+   its log won't change anymore until it is rebuilt */
+int buildinfo_finished(const char *project, const char *repo, const char *arch, const char *package)
+{
+  int finished = 0;
+  buildinfo_foreach(project, repo, arch, package, check_finished, &finished);
+  return finished;
+}
+
+/* write a string to "fp" as a JSON string literal */
+static void json_string(FILE *fp, const char *str)
+{
+  fputc('"', fp);
+  for (; *str; str++) {
+    switch (*str) {
+      case '"': fputs("\\\"", fp); break;
+      case '\\': fputs("\\\\", fp); break;
+      case '\n': fputs("\\n", fp); break;
+      case '\t': fputs("\\t", fp); break;
+      default:
+        if ((unsigned char)*str < 0x20)
+          fprintf(fp, "\\u%04x", *str);
+        else
+          fputc(*str, fp);
+        break;
+    }
+  }
+  fputc('"', fp);
+}
+
+/* package names of a project, for the rows of the text summary */
+typedef struct {
+  char *package;
+  UT_hash_handle hh;
+} pname_t;
+
+static int pname_cmp(pname_t *a, pname_t *b)
+{
+  return strcmp(a->package, b->package);
+}
+
+static void summary_text(bproject_t *bpr, FILE *fp)
+{
+  barch_t *ba, *tmp;
+  bpkg_t *bp, *ptmp;
+  pname_t *names = NULL, *pn, *ntmp;
+  int width = strlen("package");
+  
+  /* collect all packages; not every repository has all of them */
+  HASH_ITER(hh, bpr->archs, ba, tmp) {
+    HASH_ITER(hh, ba->packages, bp, ptmp) {
+      HASH_FIND_STR(names, bp->package, pn);
+      if (!pn) {
+        pn = malloc(sizeof(pname_t));
+        pn->package = bp->package;
+        HASH_ADD_KEYPTR(hh, names, pn->package, strlen(pn->package), pn);
+        if (strlen(pn->package) > width)
+          width = strlen(pn->package);
+      }
+    }
+  }
+  HASH_SORT(names, pname_cmp);
+  
+  /* matrix of status codes, one column per repository/architecture */
+  fprintf(fp, "%-*s", width, "package");
+  HASH_ITER(hh, bpr->archs, ba, tmp) {
+    fprintf(fp, "  %s", ba->key);
+  }
+  fputc('\n', fp);
+  HASH_ITER(hh, names, pn, ntmp) {
+    fprintf(fp, "%-*s", width, pn->package);
+    HASH_ITER(hh, bpr->archs, ba, tmp) {
+      HASH_FIND_STR(ba->packages, pn->package, bp);
+      fprintf(fp, "  %-*s", (int)strlen(ba->key), bp ? bp->code : "-");
+    }
+    fputc('\n', fp);
+  }
+  
+  /* details, for those that have any */
+  int have_details = 0;
+  HASH_ITER(hh, names, pn, ntmp) {
+    HASH_ITER(hh, bpr->archs, ba, tmp) {
+      HASH_FIND_STR(ba->packages, pn->package, bp);
+      if (bp && bp->details && *bp->details) {
+        if (!have_details) {
+          fputc('\n', fp);
+          have_details = 1;
+        }
+        fprintf(fp, "%s %s: %s %s\n", pn->package, ba->key, bp->code, bp->details);
+      }
+    }
+  }
+  
+  HASH_ITER(hh, names, pn, ntmp) {
+    HASH_DEL(names, pn);
+    free(pn);
+  }
+}
+
+static void summary_tsv(bproject_t *bpr, FILE *fp)
+{
+  barch_t *ba, *tmp;
+  bpkg_t *bp, *ptmp;
+  fprintf(fp, "package\trepository\tarch\tcode\tdetails\n");
+  HASH_ITER(hh, bpr->archs, ba, tmp) {
+    HASH_ITER(hh, ba->packages, bp, ptmp) {
+      fprintf(fp, "%s\t%s\t%s\t%s\t", bp->package, ba->repo, ba->arch, bp->code);
+      if (bp->details) {
+        const char *c;
+        /* keep it on one line */
+        for (c = bp->details; *c; c++)
+          fputc(*c == '\t' || *c == '\n' ? ' ' : *c, fp);
+      }
+      fputc('\n', fp);
+    }
+  }
+}
+
+static void summary_json(bproject_t *bpr, FILE *fp)
+{
+  barch_t *ba, *tmp;
+  bpkg_t *bp, *ptmp;
+  fprintf(fp, "{\"project\": ");
+  json_string(fp, bpr->project);
+  fprintf(fp, ", \"results\": [");
+  HASH_ITER(hh, bpr->archs, ba, tmp) {
+    fprintf(fp, "%s\n  {\"repository\": ", ba == bpr->archs ? "" : ",");
+    json_string(fp, ba->repo);
+    fprintf(fp, ", \"arch\": ");
+    json_string(fp, ba->arch);
+    fprintf(fp, ", \"code\": ");
+    json_string(fp, ba->code);
+    fprintf(fp, ", \"packages\": {");
+    HASH_ITER(hh, ba->packages, bp, ptmp) {
+      fprintf(fp, "%s\n    ", bp == ba->packages ? "" : ",");
+      json_string(fp, bp->package);
+      fprintf(fp, ": {\"code\": ");
+      json_string(fp, bp->code);
+      if (bp->details) {
+        fprintf(fp, ", \"details\": ");
+        json_string(fp, bp->details);
+      }
+      fprintf(fp, "}");
+    }
+    fprintf(fp, "}}");
+  }
+  fprintf(fp, "\n]}\n");
+}
+
+/* write a package x repository/architecture matrix of the build results of
+   "project"; returns -1 if we can't get them */
+int buildinfo_summary(const char *project, int format, FILE *fp)
+{
+  bproject_t *bpr;
+  if (buildinfo_result(project))
+    return -1;
+  pthread_mutex_lock(&buildinfo_mutex);
+  if (!(bpr = find_project(project))) {
+    pthread_mutex_unlock(&buildinfo_mutex);
+    return -1;
+  }
+  switch (format) {
+    case SUMMARY_TSV: summary_tsv(bpr, fp); break;
+    case SUMMARY_JSON: summary_json(bpr, fp); break;
+    default: summary_text(bpr, fp); break;
+  }
+  pthread_mutex_unlock(&buildinfo_mutex);
+  return 0;
+}
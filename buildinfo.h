@@ -0,0 +1,83 @@
+/*
+ * buildinfo.h
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "uthash.h"
+
+/* project-wide build snapshot
+   One /build/<project>/_result request gives us the build status of every
+   package in every repository and architecture, and one
+   /build/<project>/<repo>/<arch>?view=binaryversions request the binaries
+   of all packages in a repository.  That is enough to fill in the whole
+   /build tree of a project. */
+
+typedef struct {
+  char *name;
+  off_t size;
+} binary_t;
+
+/* binaries of a package */
+typedef struct {
+  char *package;
+  binary_t *binaries;
+  int num_binaries;
+  UT_hash_handle hh;
+} bbin_t;
+
+/* a package in a repository */
+typedef struct {
+  char *package;
+  char *code;		/* build status */
+  char *details;
+  UT_hash_handle hh;
+} bpkg_t;
+
+/* a repository/architecture combination */
+typedef struct {
+  char *key;		/* "<repo>/<arch>" */
+  char *repo;
+  char *arch;
+  char *code;		/* repository status */
+  bpkg_t *packages;
+  bbin_t *binaries;
+  time_t bin_timestamp;	/* 0 if we don't have the binaries */
+  UT_hash_handle hh;
+} barch_t;
+
+/* formats of the project build summary */
+enum {
+  SUMMARY_TEXT,
+  SUMMARY_TSV,
+  SUMMARY_JSON
+};
+
+typedef void (*bpkg_fn)(barch_t *ba, bpkg_t *bp, bbin_t *bb, void *userdata);
+
+void buildinfo_free(void);
+int buildinfo_result(const char *project);
+void buildinfo_invalidate(const char *project);
+int buildinfo_binaries(const char *project, const char *repo, const char *arch);
+int buildinfo_foreach_arch(const char *project, void (*fn)(barch_t *ba, void *userdata), void *userdata);
+int buildinfo_foreach(const char *project, const char *repo, const char *arch, const char *package,
+                      bpkg_fn fn, void *userdata);
+int buildinfo_status(const char *project, const char *repo, const char *arch, const char *package, FILE *fp);
+int buildinfo_finished(const char *project, const char *repo, const char *arch, const char *package);
+int buildinfo_summary(const char *project, int format, FILE *fp);
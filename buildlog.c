@@ -0,0 +1,459 @@
+/*
+ * buildlog.c
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define FUSE_USE_VERSION 28
+
+#include "buildlog.h"
+#include "obsfs.h"
+#include "util.h"
+#include "http.h"
+#include "cache.h"
+#include "zcache.h"
+#include "log.h"
+
+#include <fuse.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <expat.h>
+
+#define DEBUG_BUILDLOG
+
+#ifdef DEBUG_BUILDLOG
+#define DEBUG(x...) LOG(LOG_BG, LEVEL_DEBUG, x)
+#else
+#define DEBUG(x...)
+#endif
+
+/* open logs, by file system path */
+static log_t *log_hash = NULL;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t watcher;
+static int watcher_running = 0;
+static int shutting_down = 0;
+static int new_waiters = 0;	/* poll()s since the watcher last looked */
+static pthread_cond_t watcher_cond = PTHREAD_COND_INITIALIZER;
+
+int buildlog_is_log(const char *api_path)
+{
+  return !strncmp(api_path, "/build/", 7) && endswith(api_path, "/_log");
+}
+
+/* where the data of a log request goes */
+struct log_write {
+  zfile_t *z;		/* compressed cache file, or... */
+  int fd;		/* ...plain one */
+  off_t offset;
+  int failed;
+};
+
+static size_t log_write(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+  struct log_write *lw = (struct log_write *)userdata;
+  ssize_t ret;
+  if (lw->z)
+    ret = zcache_append(lw->z, ptr, size * nmemb) ? -1 : size * nmemb;
+  else
+    ret = pwrite(lw->fd, ptr, size * nmemb, lw->offset);
+  if (ret != size * nmemb) {
+    lw->failed = 1;
+    return 0;
+  }
+  lw->offset += ret;
+  return ret;
+}
+
+/* retrieve the log behind "api_path" from "start" on; returns 0 on success */
+static int request_log(const char *api_path, off_t start, void *write_fun, void *write_data)
+{
+  long code = 0;
+  
+  /* nostream makes the server return what it has right away, instead of
+     following a running build until it ends */
+  char *query = malloc(strlen(api_path) + strlen("?nostream=1&start=") + 32);
+  sprintf(query, "%s?nostream=1&start=%lld", api_path, (long long)start);
+  char *url = make_url(url_prefix, query, NULL);
+  free(query);
+  
+  CURL *curl = curl_open_file(url, NULL, NULL, write_fun, write_data);
+  CURLcode ret = http_perform(curl);
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+  http_close(curl);
+  free(url);
+  
+  if (ret || code != 200) {
+    DEBUG("BUILDLOG: getting %s from %lld failed (curl %d, HTTP %ld)\n", api_path, (long long)start, ret, code);
+    return -1;
+  }
+  return 0;
+}
+
+/* retrieve the log from "start" on and add it to the cache file; returns
+   the new size, or -1 on error */
+static off_t fetch_log(log_t *l, off_t start)
+{
+  struct log_write lw;
+  off_t ret;
+  
+  lw.z = l->z;
+  lw.fd = l->fd;
+  lw.offset = start;
+  lw.failed = 0;
+  if (request_log(l->api_path, start, log_write, &lw) || lw.failed) {
+    /* don't leave half a chunk behind */
+    if (l->z ? zcache_truncate(l->z, start) : ftruncate(l->fd, start))
+      perror("ftruncate");
+    ret = -1;
+  }
+  else
+    ret = lw.offset;
+  if (l->z)
+    zcache_flush(l->z);
+  return ret;
+}
+
+static void expat_entry_start(void *ud, const XML_Char *name, const XML_Char **atts)
+{
+  off_t *size = (off_t *)ud;
+  if (strcmp(name, "entry"))
+    return;
+  for (; *atts; atts += 2) {
+    if (!strcmp(atts[0], "size"))
+      *size = atoll(atts[1]);
+  }
+}
+
+static size_t parse_write(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+  XML_Parse((XML_Parser)userdata, ptr, size * nmemb, 0);
+  return size * nmemb;
+}
+
+/* get the size of the log on the server; returns -1 on error */
+static off_t remote_size(const char *api_path)
+{
+  off_t size = -1;
+  long code = 0;
+  XML_Parser xp = XML_ParserCreate(NULL);
+  if (!xp)
+    abort();
+  XML_SetUserData(xp, (void *)&size);
+  XML_SetElementHandler(xp, expat_entry_start, NULL);
+  
+  char *query = malloc(strlen(api_path) + strlen("?view=entry") + 1);
+  sprintf(query, "%s?view=entry", api_path);
+  char *url = make_url(url_prefix, query, NULL);
+  free(query);
+  CURL *curl = curl_open_file(url, NULL, NULL, parse_write, xp);
+  CURLcode ret = http_perform(curl);
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+  http_close(curl);
+  free(url);
+  XML_Parse(xp, NULL, 0, 1);
+  XML_ParserFree(xp);
+  return ret || code != 200 ? -1 : size;
+}
+
+/* skips the first, most likely incomplete, line of a log tail */
+struct tail_write {
+  FILE *fp;
+  int in_first_line;
+};
+
+static size_t tail_write(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+  struct tail_write *tw = (struct tail_write *)userdata;
+  char *data = ptr;
+  size_t len = size * nmemb;
+  if (tw->in_first_line) {
+    char *nl = memchr(data, '\n', len);
+    if (!nl)
+      return size * nmemb;
+    tw->in_first_line = 0;
+    len -= nl + 1 - data;
+    data = nl + 1;
+  }
+  if (len && fwrite(data, 1, len, tw->fp) != len)
+    return 0;
+  return size * nmemb;
+}
+
+/* write the last "len" bytes (give or take a line) of the log behind
+   "api_path" to "fp"; returns 0 on success */
+int buildlog_tail(const char *api_path, off_t len, FILE *fp)
+{
+  struct tail_write tw;
+  off_t size = remote_size(api_path);
+  if (size < 0)
+    return -1;
+  off_t start = size > len ? size - len : 0;
+  tw.fp = fp;
+  tw.in_first_line = start > 0;
+  return request_log(api_path, start, tail_write, &tw);
+}
+
+/* get what's new in the log; with "check", make sure first that the log has
+   not been restarted, as it happens when a package is rebuilt; returns the
+   size of the log */
+off_t buildlog_update(log_t *l, int check)
+{
+  struct stat st;
+  off_t size;
+  
+  pthread_mutex_lock(&l->mutex);
+  if (l->z)
+    size = l->z->size;
+  else if (!fstat(l->fd, &st))
+    size = st.st_size;
+  else {
+    pthread_mutex_unlock(&l->mutex);
+    return l->size;
+  }
+  if (check && size) {
+    off_t remote = remote_size(l->api_path);
+    if (remote >= 0 && remote < size) {
+      DEBUG("BUILDLOG: %s has been restarted\n", l->api_path);
+      if (!(l->z ? zcache_truncate(l->z, 0) : ftruncate(l->fd, 0)))
+        size = 0;
+    }
+  }
+  off_t new_size = fetch_log(l, size);
+  if (new_size > size)
+    DEBUG("BUILDLOG: got %lld bytes of %s\n", (long long)(new_size - size), l->api_path);
+  if (new_size >= 0)
+    size = new_size;
+  l->checked = time(NULL);
+  l->size = size;
+  pthread_mutex_unlock(&l->mutex);
+  
+  /* let getattr() know */
+  attr_cache_set_size(l->fs_path, size);
+  return size;
+}
+
+/* like buildlog_update(), but don't ask the server more often than every
+   LOG_REFRESH_INTERVAL seconds */
+off_t buildlog_refresh(log_t *l)
+{
+  if (time(NULL) - l->checked < LOG_REFRESH_INTERVAL)
+    return l->size;
+  return buildlog_update(l, 0);
+}
+
+/* register an open log; "fd" is the cache file */
+log_t *buildlog_open(const char *fs_path, const char *api_path, int fd)
+{
+  log_t *l;
+  pthread_mutex_lock(&log_mutex);
+  HASH_FIND_STR(log_hash, fs_path, l);
+  if (!l) {
+    l = calloc(1, sizeof(log_t));
+    l->fs_path = strdup(fs_path);
+    l->api_path = strdup(api_path);
+    l->fd = dup(fd);
+    l->z = zcache_get(fs_path);
+    pthread_mutex_init(&l->mutex, NULL);
+    HASH_ADD_KEYPTR(hh, log_hash, l->fs_path, strlen(l->fs_path), l);
+  }
+  l->refs++;
+  pthread_mutex_unlock(&log_mutex);
+  return l;
+}
+
+void buildlog_close(log_t *l)
+{
+  pthread_mutex_lock(&log_mutex);
+  if (--l->refs) {
+    pthread_mutex_unlock(&log_mutex);
+    return;
+  }
+  HASH_DEL(log_hash, l);
+  pthread_mutex_unlock(&log_mutex);
+  while (l->pollers) {
+    poller_t *p = l->pollers;
+    l->pollers = p->next;
+    fuse_pollhandle_destroy(p->ph);
+    free(p);
+  }
+  close(l->fd);
+  if (l->z)
+    zcache_release(l->z);
+  pthread_mutex_destroy(&l->mutex);
+  free(l->fs_path);
+  free(l->api_path);
+  free(l);
+}
+
+/* refresh "fs_path" if it is an open log; tail -f, for instance, looks at
+   the file size to decide if there is anything new to read */
+void buildlog_refresh_path(const char *fs_path)
+{
+  log_t *l;
+  pthread_mutex_lock(&log_mutex);
+  HASH_FIND_STR(log_hash, fs_path, l);
+  if (l)
+    l->refs++;
+  pthread_mutex_unlock(&log_mutex);
+  if (l) {
+    buildlog_refresh(l);
+    buildlog_close(l);
+  }
+}
+
+/* take the poller of "owner" off the list of "l" and return it, NULL if
+   there is none; log_mutex must be held */
+static poller_t *unlink_poller(log_t *l, const void *owner)
+{
+  poller_t **pp, *p;
+  for (pp = &l->pollers; (p = *pp); pp = &p->next) {
+    if (p->owner == owner) {
+      *pp = p->next;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+/* poll() on an open log through "owner": it is readable if it has grown
+   beyond the "seen" bytes the reader has got to already; otherwise the
+   watcher notifies "ph" once there is more.  A new poll() through the same
+   open file replaces the one before it. */
+int buildlog_poll(log_t *l, const void *owner, off_t seen, struct fuse_pollhandle *ph)
+{
+  int readable;
+  poller_t *p;
+  pthread_mutex_lock(&log_mutex);
+  readable = l->size > seen;
+  if (ph) {
+    if ((p = unlink_poller(l, owner))) {
+      fuse_pollhandle_destroy(p->ph);
+      free(p);
+    }
+    if (readable) {
+      /* nothing to wait for */
+      fuse_pollhandle_destroy(ph);
+    }
+    else {
+      p = malloc(sizeof(poller_t));
+      p->owner = owner;
+      p->ph = ph;
+      p->seen = seen;
+      p->next = l->pollers;
+      l->pollers = p;
+      new_waiters++;
+      pthread_cond_signal(&watcher_cond);
+    }
+  }
+  pthread_mutex_unlock(&log_mutex);
+  return readable;
+}
+
+/* forget the poller of "owner", which is being closed */
+void buildlog_unpoll(log_t *l, const void *owner)
+{
+  poller_t *p;
+  pthread_mutex_lock(&log_mutex);
+  p = unlink_poller(l, owner);
+  pthread_mutex_unlock(&log_mutex);
+  if (p) {
+    fuse_pollhandle_destroy(p->ph);
+    free(p);
+  }
+}
+
+/* keep refreshing logs that somebody waits for in poll() */
+static void *watcher_thread(void *arg)
+{
+  log_t *l, *tmp;
+  pthread_mutex_lock(&log_mutex);
+  while (!shutting_down) {
+    log_t **waiting = NULL;
+    int num_waiting = 0, i;
+    
+    new_waiters = 0;
+    HASH_ITER(hh, log_hash, l, tmp) {
+      if (l->pollers) {
+        waiting = realloc(waiting, (num_waiting + 1) * sizeof(log_t *));
+        waiting[num_waiting++] = l;
+        l->refs++;
+      }
+    }
+    pthread_mutex_unlock(&log_mutex);
+    
+    for (i = 0; i < num_waiting; i++) {
+      l = waiting[i];
+      off_t size = buildlog_refresh(l);
+      poller_t **pp, *p;
+      pthread_mutex_lock(&log_mutex);
+      for (pp = &l->pollers; (p = *pp); ) {
+        if (size > p->seen) {
+          fuse_notify_poll(p->ph);
+          fuse_pollhandle_destroy(p->ph);
+          *pp = p->next;
+          free(p);
+        }
+        else
+          pp = &p->next;
+      }
+      pthread_mutex_unlock(&log_mutex);
+      buildlog_close(l);
+    }
+    free(waiting);
+    
+    pthread_mutex_lock(&log_mutex);
+    if (shutting_down)
+      break;
+    if (num_waiting) {
+      /* go on with the next round in a moment */
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += LOG_REFRESH_INTERVAL;
+      pthread_cond_timedwait(&watcher_cond, &log_mutex, &ts);
+    }
+    else if (!new_waiters)
+      pthread_cond_wait(&watcher_cond, &log_mutex);
+  }
+  pthread_mutex_unlock(&log_mutex);
+  return NULL;
+}
+
+void buildlog_init(void)
+{
+  shutting_down = 0;
+  if (pthread_create(&watcher, NULL, watcher_thread, NULL))
+    perror("pthread_create");
+  else
+    watcher_running = 1;
+}
+
+void buildlog_destroy(void)
+{
+  if (!watcher_running)
+    return;
+  pthread_mutex_lock(&log_mutex);
+  shutting_down = 1;
+  pthread_cond_signal(&watcher_cond);
+  pthread_mutex_unlock(&log_mutex);
+  pthread_join(watcher, NULL);
+  watcher_running = 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * buildlog.h
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+#include <pthread.h>
+#include "uthash.h"
+
+/* build logs
+   The log of a running build keeps growing, so we only ever retrieve the
+   part we don't have yet and append it to the cached copy.  Open logs are
+   refreshed when a reader gets to the end, and periodically for readers
+   waiting in poll(). */
+
+struct fuse_pollhandle;
+struct zfile_s;
+
+/* a reader waiting in poll() for a log to grow */
+typedef struct poller {
+  struct poller *next;
+  const void *owner;	/* the open file it polls through */
+  struct fuse_pollhandle *ph;
+  off_t seen;		/* size the reader has seen */
+} poller_t;
+
+typedef struct {
+  char *fs_path;
+  char *api_path;
+  int fd;		/* cache file */
+  struct zfile_s *z;	/* the same, if it is compressed */
+  int refs;
+  off_t size;		/* what we have */
+  time_t checked;	/* last time we asked the server */
+  poller_t *pollers;	/* readers waiting for more data */
+  pthread_mutex_t mutex;	/* serializes updates */
+  UT_hash_handle hh;
+} log_t;
+
+void buildlog_init(void);
+void buildlog_destroy(void);
+int buildlog_is_log(const char *api_path);
+int buildlog_tail(const char *api_path, off_t len, FILE *fp);
+log_t *buildlog_open(const char *fs_path, const char *api_path, int fd);
+void buildlog_close(log_t *l);
+off_t buildlog_update(log_t *l, int check);
+off_t buildlog_refresh(log_t *l);
+void buildlog_refresh_path(const char *fs_path);
+int buildlog_poll(log_t *l, const void *owner, off_t seen, struct fuse_pollhandle *ph);
+void buildlog_unpoll(log_t *l, const void *owner);
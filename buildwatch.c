@@ -0,0 +1,426 @@
+/*
+ * buildwatch.c
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "buildwatch.h"
+#include "obsfs.h"
+#include "cache.h"
+#include "buildinfo.h"
+#include "util.h"
+#include "http.h"
+#include "uthash.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <expat.h>
+
+#define DEBUG_BUILDWATCH
+
+#ifdef DEBUG_BUILDWATCH
+#define DEBUG(x...) LOG(LOG_BG, LEVEL_DEBUG, x)
+#else
+#define DEBUG(x...)
+#endif
+
+/* build state of one package */
+typedef struct {
+  char *package;
+  char *code;
+  UT_hash_handle hh;
+} wpkg_t;
+
+/* build state of one repository and architecture */
+typedef struct {
+  char *key;		/* "<repo>/<arch>" */
+  char *state;		/* state and dirty flag of the repository */
+  wpkg_t *packages;
+  UT_hash_handle hh;
+} warch_t;
+
+typedef struct {
+  char *project;
+  char *state;		/* of the results we have, passed back as "oldstate" */
+  warch_t *archs;
+  time_t since;		/* when we started watching; older listings may be outdated */
+  time_t changed;	/* when we last dropped listings because of a change */
+  time_t last_used;
+  int watching;		/* our results are current */
+  UT_hash_handle hh;
+} watch_t;
+
+/* state of the _result parser */
+struct result_parse {
+  char *state;
+  warch_t *archs;
+  warch_t *cur;
+};
+
+static watch_t *watch_hash = NULL;
+static unsigned int num_watches = 0;
+static int shutting_down = 1;
+static pthread_mutex_t watch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t watch_cond = PTHREAD_COND_INITIALIZER;	/* a watcher has exited */
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;	/* we are shutting down */
+
+static void free_archs(warch_t **archs)
+{
+  warch_t *wa, *tmp;
+  wpkg_t *wp, *ptmp;
+  HASH_ITER(hh, *archs, wa, tmp) {
+    HASH_DEL(*archs, wa);
+    HASH_ITER(hh, wa->packages, wp, ptmp) {
+      HASH_DEL(wa->packages, wp);
+      free(wp->package);
+      free(wp->code);
+      free(wp);
+    }
+    free(wa->key);
+    free(wa->state);
+    free(wa);
+  }
+}
+
+static void expat_result_start(void *ud, const XML_Char *name, const XML_Char **atts)
+{
+  struct result_parse *rp = (struct result_parse *)ud;
+  if (!strcmp(name, "resultlist")) {
+    for (; *atts; atts += 2) {
+      if (!strcmp(atts[0], "state"))
+        rp->state = strdup(atts[1]);
+    }
+  }
+  else if (!strcmp(name, "result")) {
+    const char *repo = NULL, *arch = NULL, *state = "", *dirty = "";
+    for (; *atts; atts += 2) {
+      if (!strcmp(atts[0], "repository"))
+        repo = atts[1];
+      else if (!strcmp(atts[0], "arch"))
+        arch = atts[1];
+      else if (!strcmp(atts[0], "state"))
+        state = atts[1];
+      else if (!strcmp(atts[0], "dirty"))
+        dirty = atts[1];
+    }
+    rp->cur = NULL;
+    if (!repo || !arch)
+      return;
+    warch_t *wa = calloc(1, sizeof(warch_t));
+    wa->key = malloc(strlen(repo) + 1 + strlen(arch) + 1);
+    sprintf(wa->key, "%s/%s", repo, arch);
+    wa->state = malloc(strlen(state) + 1 + strlen(dirty) + 1);
+    sprintf(wa->state, "%s/%s", state, dirty);
+    HASH_ADD_KEYPTR(hh, rp->archs, wa->key, strlen(wa->key), wa);
+    rp->cur = wa;
+  }
+  else if (!strcmp(name, "status") && rp->cur) {
+    const char *package = NULL, *code = "";
+    for (; *atts; atts += 2) {
+      if (!strcmp(atts[0], "package"))
+        package = atts[1];
+      else if (!strcmp(atts[0], "code"))
+        code = atts[1];
+    }
+    if (!package)
+      return;
+    wpkg_t *wp = calloc(1, sizeof(wpkg_t));
+    wp->package = strdup(package);
+    wp->code = strdup(code);
+    HASH_ADD_KEYPTR(hh, rp->cur->packages, wp->package, strlen(wp->package), wp);
+  }
+}
+
+static size_t result_write(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+  XML_Parse((XML_Parser)userdata, ptr, size * nmemb, 0);
+  return size * nmemb;
+}
+
+/* abort the request if we are shutting down or the project is no longer
+   in use */
+static int result_progress(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+                           curl_off_t ultotal, curl_off_t ulnow)
+{
+  watch_t *w = (watch_t *)clientp;
+  int ret;
+  pthread_mutex_lock(&watch_mutex);
+  ret = shutting_down || time(NULL) - w->last_used > BUILDWATCH_IDLE;
+  pthread_mutex_unlock(&watch_mutex);
+  return ret;
+}
+
+/* get the build results of the watched project; if we have some already,
+   the server holds the request until they are different */
+static int fetch_result(watch_t *w, struct result_parse *rp)
+{
+  long code = 0;
+  int ret;
+  char *api_path = malloc(strlen("/build//_result?oldstate=") + strlen(w->project) +
+                          (w->state ? strlen(w->state) : 0) + 1);
+  sprintf(api_path, "/build/%s/_result%s%s", w->project,
+          w->state ? "?oldstate=" : "", w->state ? : "");
+  XML_Parser xp = XML_ParserCreate(NULL);
+  if (!xp)
+    abort();
+  XML_SetUserData(xp, (void *)rp);
+  XML_SetElementHandler(xp, expat_result_start, NULL);
+  
+  char *url = make_url(url_prefix, api_path, NULL);
+  CURL *curl = curl_open_file(url, NULL, NULL, result_write, xp);
+  curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, result_progress);
+  curl_easy_setopt(curl, CURLOPT_XFERINFODATA, w);
+  curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+  ret = http_perform(curl);
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+  http_close(curl);
+  free(url);
+  if (ret || code != 200) {
+    if (ret != CURLE_ABORTED_BY_CALLBACK)
+      LOG(LOG_BG, LEVEL_ERROR, "BUILDWATCH: getting %s failed (curl %d, HTTP %ld)\n", api_path, ret, code);
+    ret = -1;
+  }
+  else
+    ret = XML_Parse(xp, NULL, 0, 1) == XML_STATUS_OK && rp->state ? 0 : -1;
+  XML_ParserFree(xp);
+  free(api_path);
+  return ret;
+}
+
+static void invalidate(const char *fmt, const char *project, const char *key, const char *package)
+{
+  char *path = malloc(strlen(fmt) + strlen(project) + strlen(key) + (package ? strlen(package) : 0) + 1);
+  sprintf(path, fmt, project, key, package);
+  DEBUG("BUILDWATCH: invalidating %s\n", path);
+  if (package)
+    cache_invalidate_tree(path);
+  else
+    dir_cache_invalidate(path);
+  free(path);
+}
+
+/* drop everything we have of the /build tree of "project" */
+static void invalidate_project(const char *project)
+{
+  char *path = malloc(strlen("/build/") + strlen(project) + 1);
+  sprintf(path, "/build/%s", project);
+  DEBUG("BUILDWATCH: invalidating everything below %s\n", path);
+  cache_invalidate_tree(path);
+  free(path);
+}
+
+/* drop what has changed between the results "old" and "new" */
+static void apply_changes(const char *project, warch_t *old, warch_t *new)
+{
+  warch_t *wa, *tmp, *owa;
+  wpkg_t *wp, *ptmp, *owp;
+  
+  /* repositories have come or gone */
+  if (HASH_COUNT(old) != HASH_COUNT(new)) {
+    invalidate_project(project);
+    return;
+  }
+  HASH_ITER(hh, new, wa, tmp) {
+    HASH_FIND_STR(old, wa->key, owa);
+    if (!owa) {
+      invalidate_project(project);
+      return;
+    }
+  }
+  
+  HASH_ITER(hh, new, wa, tmp) {
+    int changed;
+    HASH_FIND_STR(old, wa->key, owa);
+    changed = strcmp(wa->state, owa->state) || HASH_COUNT(wa->packages) != HASH_COUNT(owa->packages);
+    HASH_ITER(hh, wa->packages, wp, ptmp) {
+      HASH_FIND_STR(owa->packages, wp->package, owp);
+      if (owp && !strcmp(wp->code, owp->code))
+        continue;
+      changed = 1;
+      invalidate("/build/%s/%s/%s", project, wa->key, wp->package);
+    }
+    if (changed) {
+      invalidate("/build/%s/%s", project, wa->key, NULL);
+      invalidate("/build/%s/%s/" NODE_FAILED, project, wa->key, NULL);
+      invalidate("/build/%s/" NODE_FAILED "/%s", project, wa->key, NULL);
+    }
+  }
+}
+
+static void *watch_thread(void *arg)
+{
+  watch_t *w = (watch_t *)arg;
+  struct result_parse rp;
+  
+  for (;;) {
+    pthread_mutex_lock(&watch_mutex);
+    if (shutting_down || time(NULL) - w->last_used > BUILDWATCH_IDLE)
+      break;
+    pthread_mutex_unlock(&watch_mutex);
+    
+    memset(&rp, 0, sizeof(rp));
+    time_t start = time(NULL);
+    if (fetch_result(w, &rp)) {
+      free(rp.state);
+      free_archs(&rp.archs);
+      pthread_mutex_lock(&watch_mutex);
+      /* we may have missed something; start over when the server is back */
+      w->watching = 0;
+      free(w->state);
+      w->state = NULL;
+      if (!shutting_down) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += BUILDWATCH_RETRY;
+        pthread_cond_timedwait(&wake_cond, &watch_mutex, &ts);
+      }
+      pthread_mutex_unlock(&watch_mutex);
+      continue;
+    }
+    
+    if (w->archs) {
+      /* listings retrieved before now may have been made from the results
+         we are about to drop, even if they are stored after that */
+      if (!w->state || strcmp(w->state, rp.state)) {
+        pthread_mutex_lock(&watch_mutex);
+        w->changed = time(NULL);
+        pthread_mutex_unlock(&watch_mutex);
+      }
+      apply_changes(w->project, w->archs, rp.archs);
+      buildinfo_invalidate(w->project);
+    }
+    
+    pthread_mutex_lock(&watch_mutex);
+    if (!w->since)
+      w->since = start;
+    free(w->state);
+    w->state = rp.state;
+    free_archs(&w->archs);
+    w->archs = rp.archs;
+    w->watching = 1;
+    pthread_mutex_unlock(&watch_mutex);
+  }
+  
+  DEBUG("BUILDWATCH: no longer watching %s\n", w->project);
+  HASH_DEL(watch_hash, w);
+  num_watches--;
+  pthread_cond_broadcast(&watch_cond);
+  pthread_mutex_unlock(&watch_mutex);
+  free(w->project);
+  free(w->state);
+  free_archs(&w->archs);
+  free(w);
+  return NULL;
+}
+
+/* project of the /build path "path", pointing into it; its length is 0 if
+   there is none.  "components" is set to the number of path components
+   below the project. */
+static strview_t build_project(const char *path, int *components)
+{
+  strview_t v = { NULL, 0 };
+  const char *p, *slash;
+  if (strncmp(path, "/build/", 7))
+    return v;
+  p = path + 7;
+  if (!*p || *p == '_')
+    return v;
+  slash = strchr(p, '/');
+  *components = 0;
+  if (slash) {
+    const char *c;
+    for (c = slash; c; c = strchr(c + 1, '/'))
+      (*components)++;
+  }
+  v.ptr = p;
+  v.len = slash ? slash - p : strlen(p);
+  return v;
+}
+
+void buildwatch_init(void)
+{
+  shutting_down = 0;
+  dir_cache_set_keep(buildwatch_keep);
+}
+
+void buildwatch_destroy(void)
+{
+  pthread_mutex_lock(&watch_mutex);
+  shutting_down = 1;
+  pthread_cond_broadcast(&wake_cond);
+  while (num_watches)
+    pthread_cond_wait(&watch_cond, &watch_mutex);
+  pthread_mutex_unlock(&watch_mutex);
+}
+
+/* "path" is being looked at; start watching its project if we aren't
+   already */
+void buildwatch_touch(const char *path)
+{
+  int components;
+  watch_t *w;
+  pthread_t thread;
+  strview_t project = build_project(path, &components);
+  if (!project.len)
+    return;
+  pthread_mutex_lock(&watch_mutex);
+  HASH_FIND(hh, watch_hash, project.ptr, project.len, w);
+  if (w)
+    w->last_used = time(NULL);
+  else if (!shutting_down && num_watches < BUILDWATCH_MAX) {
+    w = calloc(1, sizeof(watch_t));
+    w->project = strndup(project.ptr, project.len);
+    w->last_used = time(NULL);
+    if (pthread_create(&thread, NULL, watch_thread, w)) {
+      perror("pthread_create");
+      free(w->project);
+      free(w);
+    }
+    else {
+      DEBUG("BUILDWATCH: watching %s\n", w->project);
+      pthread_detach(thread);
+      HASH_ADD_KEYPTR(hh, watch_hash, w->project, strlen(w->project), w);
+      num_watches++;
+    }
+  }
+  pthread_mutex_unlock(&watch_mutex);
+}
+
+/* Is the listing of "path", retrieved at "timestamp", still current?
+   That is the case for repositories and everything below them if we have
+   been watching the project since before the listing was retrieved, and
+   the retrieval started after the last change we have seen.  Timestamps
+   only have seconds, so a listing started in the second of a change is
+   not kept. */
+int buildwatch_keep(const char *path, time_t timestamp)
+{
+  int components, ret = 0;
+  watch_t *w;
+  strview_t project = build_project(path, &components);
+  if (!project.len)
+    return 0;
+  if (components >= 2) {
+    pthread_mutex_lock(&watch_mutex);
+    HASH_FIND(hh, watch_hash, project.ptr, project.len, w);
+    ret = w && w->watching && timestamp >= w->since && timestamp > w->changed;
+    pthread_mutex_unlock(&watch_mutex);
+  }
+  return ret;
+}
@@ -0,0 +1,33 @@
+/*
+ * buildwatch.h
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <time.h>
+
+/* build result watcher
+   For every project whose /build tree is in use, a thread keeps a request
+   for its build results open that the server only answers once they have
+   changed (_result?oldstate=...).  The listings of the repositories and
+   packages that have changed are then dropped, and the others never
+   expire while we are watching. */
+
+void buildwatch_init(void);
+void buildwatch_destroy(void);
+void buildwatch_touch(const char *path);
+int buildwatch_keep(const char *path, time_t timestamp);
@@ -21,6 +21,7 @@
 #include "obsfs.h"
 #include "cache.h"
 #include "util.h"
+#include "log.h"
 
 #define CACHE_DEBUG
 
@@ -29,42 +30,176 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
+#include <pthread.h>
 
 #ifdef CACHE_DEBUG
-#define DEBUG(x...) fprintf(stderr, x)
+#define DEBUG(x...) LOG(LOG_CACHE, LEVEL_DEBUG, x)
 #else
 #define DEBUG(x...)
 #endif
 
-attr_t *attr_hash;
-dir_t *dir_hash;
+/* Both caches hang their entries off the nodes of the path namespace (see
+   names.h) instead of keeping hash tables of full paths. */
+static int num_attrs = 0;
+static int num_dirs = 0;
+
+/* listings below /source may be kept longer if we hear about changes there */
+static int source_timeout = 0;
+/* tells us if a listing is known to be current, whatever its age */
+static int (*keep_fn)(const char *path, time_t timestamp) = NULL;
+
+/* The caches are shared between the FUSE threads and the background
+   committer, so every method takes this lock.  It is recursive because
+   some methods call each other.  Entries handed out by the methods carry a
+   reference that keeps them from being free()d while the caller uses them
+   without the lock; it is given back with attr_cache_put() or
+   dir_cache_put().  An entry dropped from the cache while it is referenced
+   is only unlinked from its node, and free()d with its last reference. */
+static pthread_mutex_t cache_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+#define LOCK() pthread_mutex_lock(&cache_mutex)
+#define UNLOCK() pthread_mutex_unlock(&cache_mutex)
+
+/* for callers that go through the entries of a listing, which may change
+   under them otherwise */
+void cache_lock(void)
+{
+  LOCK();
+}
+
+void cache_unlock(void)
+{
+  UNLOCK();
+}
+
+/* Dropping a whole subtree entry by entry means walking all of it, so
+   instead, every node has a generation counter.  Every entry remembers the
+   sum of the counters of its node and its ancestors at the time it was
+   made, and an entry for which that sum has changed since is treated as
+   absent and dropped when it is next looked at. */
+static unsigned long gen_bumps = 0;	/* invalidations so far */
+
+static dir_t *find_dir(const char *path);
+
+/* sum of the generations of "n" and its ancestors; "last" is set to the
+   time the most recent of them was invalidated */
+static unsigned long node_gen(name_t *n, time_t *last)
+{
+  unsigned long sum = 0;
+  
+  if (last)
+    *last = 0;
+  if (!gen_bumps)
+    return 0;
+  for (; n; n = n->parent) {
+    sum += n->gen;
+    if (last && n->gen_time > *last)
+      *last = n->gen_time;
+  }
+  return sum;
+}
+
+/* Has the subtree of an entry for "n" made at generation "*gen" been
+   invalidated since?  "*checked" saves us from asking again until the next
+   invalidation.  Modified entries are never out of date; they move on to
+   the current generation instead. */
+static int outdated(name_t *n, unsigned long *gen, unsigned long *checked, int modified)
+{
+  unsigned long cur;
+  if (*checked == gen_bumps)
+    return 0;
+  cur = node_gen(n, NULL);
+  if (cur != *gen && !modified)
+    return 1;
+  *gen = cur;
+  *checked = gen_bumps;
+  return 0;
+}
+
+/* forget everything cached for "prefix" and below it */
+void cache_invalidate_tree(const char *prefix)
+{
+  name_t *n;
+  LOCK();
+  n = names_lookup(prefix, 1);
+  n->gen++;
+  n->gen_time = time(NULL);
+  gen_bumps++;
+  DEBUG("CACHE: invalidating everything below %s, generation %lu\n", prefix, n->gen);
+  UNLOCK();
+}
+
+/* Has the subtree containing "path" been invalidated at or after "since"?
+   Used for cached files, which are not kept here. */
+int cache_tree_changed(const char *path, time_t since)
+{
+  time_t last;
+  LOCK();
+  node_gen(names_closest(path), &last);
+  UNLOCK();
+  return last && last >= since;
+}
+
+/* write statistics on the caches to "fp" */
+void cache_report(FILE *fp)
+{
+  LOCK();
+  fprintf(fp, "attribute entries: %d (%zu bytes each)\n", num_attrs, sizeof(attr_t));
+  fprintf(fp, "directory entries: %d (%zu bytes each)\n", num_dirs, sizeof(dir_t));
+  fprintf(fp, "invalidations: %lu\n", gen_bumps);
+  names_report(fp);
+  UNLOCK();
+}
 
 /* clear attribute cache */
 void attr_cache_init(void)
 {
-  attr_hash = NULL;
+  num_attrs = 0;
 }
 
 static void free_attr(attr_t *h)
 {
-    free(h->path);
     if (h->symlink)
       free(h->symlink);
     if (h->hardlink)
       free(h->hardlink);
     if (h->rev)
       free(h->rev);
+    if (h->md5)
+      free(h->md5);
     free(h);
+    num_attrs--;
 }
 
-/* add an entry to the attribute cache */
-void attr_cache_add(const char *path, struct stat *st, const char *symlink, const char *hardlink, const char *rev)
+/* take an entry out of the cache and free() it unless it is still
+   referenced; its node is left to the caller */
+static void drop_attr(attr_t *h)
+{
+  h->node->attr = NULL;
+  h->node = NULL;
+  if (!h->refs)
+    free_attr(h);
+}
+
+/* give back a reference to an entry handed out by one of the methods */
+void attr_cache_put(attr_t *h)
+{
+  if (!h)
+    return;
+  LOCK();
+  if (!--h->refs && !h->node)
+    free_attr(h);
+  UNLOCK();
+}
+
+/* add an entry for "n" to the attribute cache, or make an entry that is
+   not in the cache if "n" is NULL; the "modified" flag and MD5 sum of an
+   existing entry for it are carried over */
+static attr_t *add_attr(name_t *n, struct stat *st, const char *symlink, const char *hardlink, const char *rev)
 {
   attr_t *h = calloc(1, sizeof(attr_t));
+  attr_t *old = n ? n->attr : NULL;
 
-  /* create the new entry; do this before deleting the old one because symlink
-     and hardlink may point to it */
-  h->path = strdup(path);
+  h->node = n;
   h->st = *st;
   if (symlink)
     h->symlink = strdup(symlink);
@@ -73,103 +208,411 @@ void attr_cache_add(const char *path, struct stat *st, const char *symlink, cons
   if (rev)
     h->rev = strdup(rev);
   h->timestamp = time(NULL);
+  h->gen = n ? node_gen(n, NULL) : 0;
+  h->checked = gen_bumps;
+  num_attrs++;
   
   /* need to delete old entry, if any */
-  attr_t *old;
-  HASH_FIND_STR(attr_hash, path, old);
   if (old) {
-    DEBUG("ATTR CACHE: found old entry for %s\n", path);
-    HASH_DEL(attr_hash, old);
-    free_attr(old);
+    DEBUG("ATTR CACHE: found old entry for %s\n", n->name);
+    h->modified = old->modified;
+    h->writes = old->writes;
+    if (old->md5)
+      h->md5 = strdup(old->md5);
+    drop_attr(old);
   }
-  
-  /* can't use the HASH_ADD_STR() convenience macro here because it
-     expects the key to be an array inside the hash structure, not
-     a pointer somewhere else; HASH_FIND_STR() works fine, though. */
-  HASH_ADD_KEYPTR(hh, attr_hash, h->path, strlen(h->path), h);
+  if (n)
+    n->attr = h;
+  h->refs = 1;
+  return h;
 }
 
-/* retrieve an entry from the attribute cache */
-attr_t *attr_cache_find(const char *path)
+/* add an entry to the attribute cache; the "modified" flag and MD5 sum of
+   an existing entry for the same path are carried over */
+void attr_cache_add(const char *path, struct stat *st, const char *symlink, const char *hardlink, const char *rev)
+{
+  LOCK();
+  add_attr(names_lookup(path, 1), st, symlink, hardlink, rev)->refs--;
+  UNLOCK();
+}
+
+/* the same for the node "name" in the listing "dir", which saves us from
+   looking up its full path; if "dir" has been dropped from the cache in
+   the meantime, so is the new entry */
+attr_t *attr_cache_add_child(dir_t *dir, const char *name, struct stat *st, const char *symlink, const char *hardlink, const char *rev)
 {
   attr_t *h;
-  HASH_FIND_STR(attr_hash, path, h);
-  if (h) {
+  LOCK();
+  h = add_attr(dir->node ? names_child(dir->node, name, strlen(name), 1) : NULL, st, symlink, hardlink, rev);
+  UNLOCK();
+  return h;
+}
+
+/* remember the MD5 sum the server has for an entry */
+void attr_cache_set_md5(attr_t *h, const char *md5)
+{
+  LOCK();
+  if (h->md5)
+    free(h->md5);
+  h->md5 = md5 ? strdup(md5) : NULL;
+  UNLOCK();
+}
+
+/* look up the entry for "path", dropping it if it is out of date */
+static attr_t *find_attr(const char *path)
+{
+  attr_t *h = NULL;
+  name_t *n;
+  n = names_lookup(path, 0);
+  if (n && (h = n->attr)) {
     DEBUG("ATTR CACHE: found hash entry for %s\n", path);
-    if (time(NULL) - h->timestamp > ATTR_CACHE_TIMEOUT && !h->modified) {
+    if (outdated(n, &h->gen, &h->checked, h->modified)) {
+      DEBUG("ATTR CACHE: entry %s invalidated, deleting\n", path);
+      drop_attr(h);
+      names_release(n);
+      h = NULL;
+    }
+    else if (time(NULL) - h->timestamp > ATTR_CACHE_TIMEOUT && !h->modified) {
       DEBUG("ATTR CACHE: timeout for entry %s, deleting\n", path);
-      HASH_DEL(attr_hash, h);
-      free_attr(h);
-      return NULL;
+      drop_attr(h);
+      names_release(n);
+      h = NULL;
     }
   }
   return h;
 }
 
+/* retrieve an entry from the attribute cache */
+attr_t *attr_cache_find(const char *path)
+{
+  attr_t *h;
+  LOCK();
+  h = find_attr(path);
+  if (h)
+    h->refs++;
+  UNLOCK();
+  return h;
+}
+
+static void free_attrs(name_t *n)
+{
+  name_t *c, *tmp;
+  if (n->attr)
+    drop_attr(n->attr);
+  HASH_ITER(hh, n->children, c, tmp)
+    free_attrs(c);
+}
+
 /* free() memory used by attribute cache entries */
 void attr_cache_free(void)
 {
-  attr_t *h, *tmp;
-  /* delete every attr_hash entry in the table and in memory */
-  HASH_ITER(hh, attr_hash, h, tmp) {
-    HASH_DEL(attr_hash, h);
-    free_attr(h);
-  }
+  LOCK();
+  free_attrs(names_root());
+  UNLOCK();
 }
 
 void attr_cache_remove(const char *path)
 {
-  attr_t *h = attr_cache_find(path);
+  LOCK();
+  attr_t *h = find_attr(path);
   if (h) {
-    HASH_DEL(attr_hash, h);
-    free_attr(h);
+    name_t *n = h->node;
+    drop_attr(h);
+    names_release(n);
+  }
+  UNLOCK();
+}
+
+/* drop the unmodified entries below "n", whose path is "path" (or only
+   those directly in it), calling "fn" for each of them first */
+static void invalidate_below(name_t *n, const char *path, int children_only, void (*fn)(const char *path))
+{
+  name_t *c, *tmp;
+  HASH_ITER(hh, n->children, c, tmp) {
+    char *cpath = malloc(strlen(path) + 1 + strlen(c->name) + 1);
+    sprintf(cpath, "%s/%s", path, c->name);
+    if (c->attr && !c->attr->modified) {
+      if (fn)
+        fn(cpath);
+      drop_attr(c->attr);
+    }
+    if (!children_only)
+      invalidate_below(c, cpath, 0, fn);
+    free(cpath);
+  }
+}
+
+/* drop the unmodified entries below "prefix" (or only those directly in
+   it), calling "fn" for each of them first */
+void attr_cache_invalidate_prefix(const char *prefix, int children_only, void (*fn)(const char *path))
+{
+  name_t *n;
+  LOCK();
+  n = names_lookup(prefix, 0);
+  if (n) {
+    invalidate_below(n, prefix, children_only, fn);
+    names_prune(n);
   }
+  UNLOCK();
 }
 
+/* Mark a node as about to be written to, making it at least "size" bytes
+   long; returns -1 if there is no entry for it.  The write generation of
+   the node is bumped here and again by attr_cache_written() once the data
+   is in the file, and the new one is stored in "gen".  If the generation
+   attr_cache_written() returns is not "*gen" + 1, another write has
+   happened in between. */
+int attr_cache_set_modified(const char *path, off_t size, unsigned long *gen)
+{
+  LOCK();
+  attr_t *h = find_attr(path);
+  if (!h) {
+    UNLOCK();
+    return -1;
+  }
+  if (!h->modified) {
+    h->modified = 1;
+    char dn[PATH_MAX];
+    dir_t *dir = dirname_buf(path, dn, sizeof(dn), NULL) ? NULL : find_dir(dn);
+    if (dir)
+      dir->modified++;
+  }
+  if (size > h->st.st_size)
+    h->st.st_size = size;
+  *gen = ++h->writes;
+  UNLOCK();
+  return 0;
+}
+
+/* see attr_cache_set_modified() */
+unsigned long attr_cache_written(const char *path)
+{
+  unsigned long gen = 0;
+  LOCK();
+  attr_t *h = find_attr(path);
+  if (h)
+    gen = ++h->writes;
+  UNLOCK();
+  return gen;
+}
+
+/* update the size of a node, e.g. of a log that has grown */
+void attr_cache_set_size(const char *path, off_t size)
+{
+  LOCK();
+  attr_t *h = find_attr(path);
+  if (h)
+    h->st.st_size = size;
+  UNLOCK();
+}
+
+/* current write generation of a node, without bumping it */
+unsigned long attr_cache_generation(const char *path)
+{
+  unsigned long gen = 0;
+  LOCK();
+  attr_t *h = find_attr(path);
+  if (h)
+    gen = h->writes;
+  UNLOCK();
+  return gen;
+}
+
+static void clear_modified(const char *path, attr_t *h)
+{
+  if (h && h->modified) {
+    h->modified = 0;
+    char dn[PATH_MAX];
+    dir_t *dir = dirname_buf(path, dn, sizeof(dn), NULL) ? NULL : find_dir(dn);
+    if (dir && dir->modified)
+      dir->modified--;
+  }
+}
+
+/* mark a node as synced with the server, undoing what attr_cache_set_modified() did */
+void attr_cache_clear_modified(const char *path)
+{
+  LOCK();
+  clear_modified(path, find_attr(path));
+  UNLOCK();
+}
+
+/* like attr_cache_clear_modified(), but only if nothing has been written
+   to the node since attr_cache_generation() returned "gen" */
+void attr_cache_clear_modified_gen(const char *path, unsigned long gen)
+{
+  LOCK();
+  attr_t *h = find_attr(path);
+  if (h && h->writes == gen)
+    clear_modified(path, h);
+  UNLOCK();
+}
+
+/* How often a directory's listing changes varies wildly, from build
+   results that change all the time to projects nobody has touched in
+   years.  Every time a listing is replaced, we compare it with the one
+   before it; if nothing has changed, the next one is kept twice as long,
+   otherwise only half as long, between ttl_min and ttl_max seconds.  The
+   history is kept in the directory's node. */
+static int ttl_min = DIR_CACHE_TIMEOUT;
+static int ttl_max = DIR_CACHE_TIMEOUT;
+
 /* clear directory cache */
 void dir_cache_init(void)
 {
-  dir_hash = NULL;
+  num_dirs = 0;
+}
+
+/* set the bounds of the directory timeouts; with "min" equal to "max",
+   every listing is kept for that long */
+void dir_cache_set_ttl(int min, int max)
+{
+  ttl_min = min;
+  ttl_max = max > min ? max : min;
+}
+
+/* nodes that have a learned timeout, oldest first; when there are too
+   many, the oldest ones forget theirs, so that their nodes can go */
+static name_t *ttl_nodes[DIR_TTL_HISTORY];
+static int ttl_first = 0, ttl_count = 0;
+
+/* remember that "n" has a learned timeout now */
+static void ttl_track(name_t *n)
+{
+  if (ttl_count == DIR_TTL_HISTORY) {
+    name_t *old = ttl_nodes[ttl_first];
+    ttl_first = (ttl_first + 1) % DIR_TTL_HISTORY;
+    ttl_count--;
+    old->ttl = 0;
+    old->listing = 0;
+    names_release(old);
+  }
+  ttl_nodes[(ttl_first + ttl_count++) % DIR_TTL_HISTORY] = n;
+}
+
+/* FNV-1a hash of "len" bytes at "p", continuing from "h" */
+static uint64_t fnv(uint64_t h, const void *p, size_t len)
+{
+  const unsigned char *c = p;
+  while (len--)
+    h = (h ^ *c++) * 1099511628211ULL;
+  return h;
+}
+
+/* hash of a listing: the names, types, sizes, and modification times of
+   its entries, and its revision and srcmd5, so that a commit that only
+   changes the contents of files counts as a change as well */
+static uint64_t listing_hash(dir_t *d)
+{
+  uint64_t h = 14695981039346656037ULL;
+  int i;
+  if (d->rev)
+    h = fnv(h, d->rev, strlen(d->rev) + 1);
+  if (d->srcmd5)
+    h = fnv(h, d->srcmd5, strlen(d->srcmd5) + 1);
+  for (i = 0; i < d->num_entries; i++) {
+    const char *name = d->entries[i].name;
+    name_t *c = names_child(d->node, name, strlen(name), 0);
+    h = fnv(h, name, strlen(name) + 1);
+    h = fnv(h, &d->entries[i].is_dir, sizeof(int));
+    if (c && c->attr) {
+      h = fnv(h, &c->attr->st.st_size, sizeof(off_t));
+      h = fnv(h, &c->attr->st.st_mtime, sizeof(time_t));
+    }
+  }
+  return h;
+}
+
+/* the listing "d" of "path" is about to be replaced; see if it was
+   different from the one before it and adapt the timeout of its
+   directory */
+static void learn_ttl(const char *path, dir_t *d)
+{
+  name_t *n = d->node;
+  uint64_t h;
+  if (ttl_min == ttl_max || d->modified)
+    return;
+  h = listing_hash(d);
+  if (!n->ttl) {
+    n->listing = h;
+    n->ttl = DIR_CACHE_TIMEOUT < ttl_min ? ttl_min : DIR_CACHE_TIMEOUT > ttl_max ? ttl_max : DIR_CACHE_TIMEOUT;
+    ttl_track(n);
+    return;
+  }
+  if (h == n->listing)
+    n->ttl = n->ttl * 2 > ttl_max ? ttl_max : n->ttl * 2;
+  else
+    n->ttl = n->ttl / 2 < ttl_min ? ttl_min : n->ttl / 2;
+  DEBUG("DIR CACHE: %s %s, timeout now %d\n", path, h == n->listing ? "unchanged" : "changed", n->ttl);
+  n->listing = h;
 }
 
 /* free() the memory occupied by a directory cache entry (if any) */
 static void free_dir(dir_t *d)
 {
   int i;
-  if (d->path) {
-    free(d->path);
-    if (d->rev)
-      free(d->rev);
-    if (d->entries) {
-      for (i = 0; i < d->num_entries; i++) {
-        free(d->entries[i].name);
-      }
-      free(d->entries);
+  if (d->rev)
+    free(d->rev);
+  if (d->srcmd5)
+    free(d->srcmd5);
+  if (d->entries) {
+    for (i = 0; i < d->num_entries; i++) {
+      free(d->entries[i].name);
     }
+    free(d->entries);
   }
   free(d);
+  num_dirs--;
+}
+
+/* take a directory cache entry out of the cache and free() it unless it
+   is still referenced; its node is left to the caller */
+static void drop_dir(dir_t *d)
+{
+  d->node->dir = NULL;
+  d->node = NULL;
+  if (!d->refs)
+    free_dir(d);
+}
+
+/* give back a reference to an entry handed out by one of the methods */
+void dir_cache_put(dir_t *d)
+{
+  if (!d)
+    return;
+  LOCK();
+  if (!--d->refs && !d->node)
+    free_dir(d);
+  UNLOCK();
 }
 
 /* create a new directory cache entry */
 dir_t *dir_cache_new(const char *path)
 {
   dir_t *d;
-  HASH_FIND_STR(dir_hash, path, d);
+  name_t *n;
+  LOCK();
+  n = names_lookup(path, 1);
   /* we don't care about collisions, but we need to free() an old entry there is one */
-  if (d) {
+  if ((d = n->dir)) {
     DEBUG("DIR CACHE: found old entry for %s\n", path);
-    HASH_DEL(dir_hash, d);
-    free_dir(d);
+    learn_ttl(path, d);
+    drop_dir(d);
   }
 
   d = calloc(1, sizeof(dir_t));
-  d->path = strdup(path);
+  d->node = n;
   d->entries = NULL;
   d->num_entries = 0;
   d->timestamp = time(NULL);
+  d->gen = node_gen(n, NULL);
+  d->checked = gen_bumps;
+  num_dirs++;
   
   DEBUG("DIR CACHE: adding new entry for %s\n", path);
-  HASH_ADD_KEYPTR(hh, dir_hash, d->path, strlen(d->path), d);
+  n->dir = d;
+  d->refs = 1;
+  UNLOCK();
   
   return d;
 }
@@ -178,42 +621,179 @@ dir_t *dir_cache_new(const char *path)
 void dir_cache_add(dir_t *dir, const char *name, int is_dir)
 {
   dirent_t *de;
+  LOCK();
   /* allocate memory for one more node */
   dir->entries = realloc(dir->entries, (dir->num_entries + 1) * sizeof(dirent_t));
   de = &dir->entries[dir->num_entries];	/* pointer to the last node */
   de->name = strdup(name);
   de->is_dir = is_dir;
   dir->num_entries++;
+  UNLOCK();
 }
 
-/* retrieve a directory cache entry */
-dir_t *dir_cache_find(const char *path)
+/* look up the entry for "path", dropping it if it has been invalidated */
+static dir_t *lookup_dir(const char *path)
+{
+  name_t *n = names_lookup(path, 0);
+  dir_t *d = n ? n->dir : NULL;
+  if (d && outdated(n, &d->gen, &d->checked, d->modified)) {
+    DEBUG("DIR CACHE: entry %s invalidated, deleting\n", path);
+    drop_dir(d);
+    names_release(n);
+    d = NULL;
+  }
+  return d;
+}
+
+/* Has the directory cache entry "d" for "path" timed out? */
+static int dir_expired(const char *path, dir_t *d)
+{
+  int timeout = d->node->ttl ? : DIR_CACHE_TIMEOUT;
+  /* _my_projects and _my_packages are not sources */
+  if (source_timeout && !strncmp(path, "/source/", 8) && path[8] != '_')
+    timeout = source_timeout;
+  return (time(NULL) - d->timestamp) > (timeout + d->num_entries / 10)
+         && !d->modified && !(keep_fn && keep_fn(path, d->timestamp));
+}
+
+/* "fn" is asked before a listing expires if it is still current; it is
+   called with the cache locked, so it must not use the cache itself */
+void dir_cache_set_keep(int (*fn)(const char *path, time_t timestamp))
+{
+  keep_fn = fn;
+}
+
+/* set the timeout of listings below /source */
+void dir_cache_set_source_timeout(int seconds)
+{
+  source_timeout = seconds;
+}
+
+/* look up the entry for "path", dropping it if it is out of date */
+static dir_t *find_dir(const char *path)
 {
   dir_t *d;
-  HASH_FIND_STR(dir_hash, path, d);
+  d = lookup_dir(path);
   if (!d) {
     DEBUG("DIR CACHE: no entry found for %s\n", path);
-    return NULL;
   }
   else {
     DEBUG("DIR CACHE: found entry for %s\n", path);
-    if ((time(NULL) - d->timestamp) > (DIR_CACHE_TIMEOUT + d->num_entries / 10)
-        && !d->modified) {
+    if (dir_expired(path, d)) {
+      name_t *n = d->node;
       DEBUG("DIR CACHE: timeout for entry %s, deleting\n", path);
-      HASH_DEL(dir_hash, d);
-      free_dir(d);
-      return NULL;
+      learn_ttl(path, d);
+      drop_dir(d);
+      names_release(n);
+      d = NULL;
+    }
+  }
+  return d;
+}
+
+/* retrieve a directory cache entry */
+dir_t *dir_cache_find(const char *path)
+{
+  dir_t *d;
+  LOCK();
+  d = find_dir(path);
+  if (d)
+    d->refs++;
+  UNLOCK();
+  return d;
+}
+/* position of the subdirectory "name" among the subdirectories in the
+   entry for "path"; returns -1 if there is no such thing */
+int dir_cache_subdir_index(const char *path, const char *name)
+{
+  dir_t *d;
+  int i, n = 0, ret = -1;
+  LOCK();
+  d = lookup_dir(path);
+  if (d) {
+    for (i = 0; i < d->num_entries; i++) {
+      if (!d->entries[i].is_dir)
+        continue;
+      if (!strcmp(d->entries[i].name, name)) {
+        ret = n;
+        break;
+      }
+      n++;
+    }
+  }
+  UNLOCK();
+  return ret;
+}
+
+/* name of the "n"th subdirectory in the entry for "path", to be free()d by
+   the caller; returns NULL if there is none */
+char *dir_cache_subdir(const char *path, int n)
+{
+  dir_t *d;
+  int i;
+  char *ret = NULL;
+  LOCK();
+  d = lookup_dir(path);
+  if (d) {
+    for (i = 0; i < d->num_entries; i++) {
+      if (d->entries[i].is_dir && !n--) {
+        ret = strdup(d->entries[i].name);
+        break;
+      }
     }
-    return d;
   }
+  UNLOCK();
+  return ret;
+}
+
+/* Is there a valid entry for "path"?  Unlike dir_cache_find(), this
+   leaves expired entries alone. */
+int dir_cache_fresh(const char *path)
+{
+  dir_t *d;
+  int ret;
+  LOCK();
+  d = lookup_dir(path);
+  ret = d && !dir_expired(path, d);
+  UNLOCK();
+  return ret;
+}
+
+/* Is there an expired entry for "path" that could be revalidated by its
+   srcmd5? */
+int dir_cache_stale(const char *path)
+{
+  dir_t *d;
+  int ret;
+  LOCK();
+  d = lookup_dir(path);
+  ret = d && d->srcmd5 && dir_expired(path, d);
+  UNLOCK();
+  return ret;
+}
+
+/* restart the timeout of the entry for "path" if its sources are still
+   the same as those identified by "srcmd5" */
+void dir_cache_revalidate(const char *path, const char *srcmd5)
+{
+  dir_t *d;
+  LOCK();
+  d = lookup_dir(path);
+  if (d && d->srcmd5 && !strcmp(d->srcmd5, srcmd5)) {
+    DEBUG("DIR CACHE: %s is unchanged, renewing\n", path);
+    d->timestamp = time(NULL);
+  }
+  UNLOCK();
 }
 
 void dir_cache_remove(const char *path)
 {
-  char *bn, *dn;
-  dn = dirname_c(path, &bn);
-  dir_t *d = dir_cache_find(dn);
-  free(dn);
+  const char *bn;
+  char dn[PATH_MAX];
+  if (dirname_buf(path, dn, sizeof(dn), &bn))
+    return;
+  LOCK();
+  dir_t *d = find_dir(dn);
   if (d) {
     int i, j;
     for (i = 0; i < d->num_entries; i++) {
@@ -223,30 +803,59 @@ void dir_cache_remove(const char *path)
           d->entries[j - 1] = d->entries[j];
         }
         d->num_entries--;
-        return;
+        break;
       }
     }
   }
+  UNLOCK();
+}
+
+/* drop the directory cache entry for "path" itself, so that it is
+   retrieved from the server again the next time it is needed */
+void dir_cache_invalidate(const char *path)
+{
+  name_t *n;
+  LOCK();
+  n = names_lookup(path, 0);
+  if (n && n->dir) {
+    DEBUG("DIR CACHE: invalidating entry for %s\n", path);
+    drop_dir(n->dir);
+    names_release(n);
+  }
+  UNLOCK();
 }
 
 void dir_cache_add_dir_by_name(const char *path)
 {
-  char *bn, *dn;
-  dn = dirname_c(path, &bn);
-  dir_t *d = dir_cache_find(dn);
-  free(dn);
+  const char *bn;
+  char dn[PATH_MAX];
+  if (dirname_buf(path, dn, sizeof(dn), &bn))
+    return;
+  LOCK();
+  dir_t *d = find_dir(dn);
   if (d) {
-    fprintf(stderr, "%s: adding %s to %s\n", __FUNCTION__, bn, d->path);
+    DEBUG("%s: adding %s to %s\n", __FUNCTION__, bn, dn);
     dir_cache_add(d, bn, 1);
   }
+  UNLOCK();
+}
+
+static void free_dirs(name_t *n)
+{
+  name_t *c, *tmp;
+  if (n->dir)
+    drop_dir(n->dir);
+  HASH_ITER(hh, n->children, c, tmp)
+    free_dirs(c);
 }
 
-/* free() memory used by directory cache entries */
+/* free() memory used by directory cache entries, and the namespace along
+   with it */
 void dir_cache_free(void)
 {
-  dir_t *d, *tmp;
-  HASH_ITER(hh, dir_hash, d, tmp) {
-    HASH_DEL(dir_hash, d);
-    free_dir(d);
-  }
+  LOCK();
+  free_dirs(names_root());
+  ttl_first = ttl_count = 0;
+  names_free();
+  UNLOCK();
 }
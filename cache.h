@@ -20,16 +20,20 @@
 
 #include <sys/stat.h>
 #include "uthash.h"
+#include "names.h"
 
-typedef struct {
-  char *path;
+typedef struct attr {
+  name_t *node;
   struct stat st;
   char *symlink;
   char *hardlink;
   time_t timestamp;
   int modified;
   char *rev;	/* build service revision */
-  UT_hash_handle hh;
+  char *md5;	/* MD5 sum of the file's contents on the server */
+  unsigned long gen, checked;	/* see cache_invalidate_tree() */
+  int refs;	/* references handed out, see attr_cache_put() */
+  unsigned long writes;	/* write generation, see attr_cache_set_modified() */
 } attr_t;
 
 /* one node of a directory cache entry */
@@ -39,28 +43,57 @@ typedef struct {
 } dirent_t;
 
 /* directory cache entry */
-typedef struct {
-  char *path;
+typedef struct dir {
+  name_t *node;
   dirent_t *entries;
   int num_entries;
   time_t timestamp;
   int modified;
   char *rev; /* build service revision */
-  UT_hash_handle hh;
+  char *srcmd5; /* source directories: MD5 sum identifying the sources */
+  unsigned long gen, checked;	/* see cache_invalidate_tree() */
+  int refs;	/* references handed out, see dir_cache_put() */
 } dir_t;
 
+/* subtree invalidation, for both caches */
+void cache_invalidate_tree(const char *prefix);
+int cache_tree_changed(const char *path, time_t since);
+void cache_report(FILE *fp);
+void cache_lock(void);
+void cache_unlock(void);
+
 /* attribute cache methods */
 void attr_cache_init(void);
 void attr_cache_add(const char *path, struct stat *st, const char *symlink, const char *hardlink, const char *rev);
+attr_t *attr_cache_add_child(dir_t *dir, const char *name, struct stat *st, const char *symlink, const char *hardlink, const char *rev);
+void attr_cache_set_md5(attr_t *h, const char *md5);
 attr_t *attr_cache_find(const char *path);
+void attr_cache_put(attr_t *h);
 void attr_cache_free(void);
 void attr_cache_remove(const char *path);
+int attr_cache_set_modified(const char *path, off_t size, unsigned long *gen);
+unsigned long attr_cache_written(const char *path);
+void attr_cache_set_size(const char *path, off_t size);
+unsigned long attr_cache_generation(const char *path);
+void attr_cache_clear_modified(const char *path);
+void attr_cache_clear_modified_gen(const char *path, unsigned long gen);
+void attr_cache_invalidate_prefix(const char *prefix, int children_only, void (*fn)(const char *path));
 
 /* directory cache methods */
 void dir_cache_init(void);
 dir_t *dir_cache_new(const char *path);
 void dir_cache_add(dir_t *dir, const char *name, int is_dir);
 void dir_cache_remove(const char *path);
+void dir_cache_invalidate(const char *path);
+void dir_cache_set_source_timeout(int seconds);
+void dir_cache_set_keep(int (*fn)(const char *path, time_t timestamp));
+void dir_cache_set_ttl(int min, int max);
 void dir_cache_add_dir_by_name(const char *path);
 dir_t *dir_cache_find(const char *path);
+void dir_cache_put(dir_t *d);
+int dir_cache_fresh(const char *path);
+int dir_cache_subdir_index(const char *path, const char *name);
+char *dir_cache_subdir(const char *path, int n);
+int dir_cache_stale(const char *path);
+void dir_cache_revalidate(const char *path, const char *srcmd5);
 void dir_cache_free(void);
@@ -0,0 +1,268 @@
+/*
+ * changes.c
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "changes.h"
+#include "obsfs.h"
+#include "cache.h"
+#include "prjinfo.h"
+#include "util.h"
+#include "http.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <expat.h>
+
+#define DEBUG_CHANGES
+
+#ifdef DEBUG_CHANGES
+#define DEBUG(x...) LOG(LOG_BG, LEVEL_DEBUG, x)
+#else
+#define DEBUG(x...)
+#endif
+
+/* one entry in a feed */
+typedef struct {
+  char *project;
+  char *package;	/* NULL for projects */
+  char *time;
+} change_t;
+
+/* a feed and what we have seen of it */
+typedef struct {
+  const char *name;	/* "latest_updated" or "latest_added" */
+  const char *time_attr;	/* attribute with the time of the change */
+  char *last;		/* newest change seen so far */
+} feed_t;
+
+static feed_t feeds[] = {
+  { "latest_updated", "updated", NULL },
+  { "latest_added", "created", NULL },
+};
+
+struct feed_parse {
+  feed_t *feed;
+  change_t *changes;
+  int num_changes;
+};
+
+static pthread_t poller;
+static int poller_running = 0;
+static int shutting_down = 0;
+static pthread_mutex_t changes_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changes_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int poll_interval;
+static void (*drop_fn)(const char *path);
+
+static void expat_feed_start(void *ud, const XML_Char *name, const XML_Char **atts)
+{
+  struct feed_parse *fp = (struct feed_parse *)ud;
+  const char *nm = NULL, *project = NULL, *time = NULL;
+  int is_package = !strcmp(name, "package");
+  
+  if (!is_package && strcmp(name, "project"))
+    return;
+  for (; *atts; atts += 2) {
+    if (!strcmp(atts[0], "name"))
+      nm = atts[1];
+    else if (!strcmp(atts[0], "project"))
+      project = atts[1];
+    else if (!strcmp(atts[0], fp->feed->time_attr))
+      time = atts[1];
+  }
+  if (!nm || !time || (is_package && !project))
+    return;
+  fp->changes = realloc(fp->changes, (fp->num_changes + 1) * sizeof(change_t));
+  change_t *c = &fp->changes[fp->num_changes++];
+  c->project = strdup(is_package ? project : nm);
+  c->package = is_package ? strdup(nm) : NULL;
+  c->time = strdup(time);
+}
+
+static size_t feed_write(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+  XML_Parse((XML_Parser)userdata, ptr, size * nmemb, 0);
+  return size * nmemb;
+}
+
+/* get the newest CHANGES_LIMIT entries of a feed; returns 0 on success */
+static int fetch_feed(struct feed_parse *fp)
+{
+  char path[64];
+  long code = 0;
+  int ret;
+  XML_Parser xp = XML_ParserCreate(NULL);
+  if (!xp)
+    abort();
+  XML_SetUserData(xp, (void *)fp);
+  XML_SetElementHandler(xp, expat_feed_start, NULL);
+  
+  sprintf(path, "/statistics/%s?limit=%d", fp->feed->name, CHANGES_LIMIT);
+  char *url = make_url(url_prefix, path, NULL);
+  CURL *curl = curl_open_file(url, NULL, NULL, feed_write, xp);
+  ret = http_perform(curl);
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+  http_close(curl);
+  free(url);
+  if (ret || code != 200) {
+    LOG(LOG_BG, LEVEL_ERROR, "CHANGES: getting %s failed (curl %d, HTTP %ld)\n", path, ret, code);
+    ret = -1;
+  }
+  else
+    ret = XML_Parse(xp, NULL, 0, 1) == XML_STATUS_OK ? 0 : -1;
+  XML_ParserFree(xp);
+  return ret;
+}
+
+/* drop everything we have cached of "path" and below it */
+static void invalidate_tree(const char *path)
+{
+  DEBUG("CHANGES: invalidating %s\n", path);
+  cache_invalidate_tree(path);
+}
+
+/* act on one entry of a feed */
+static void apply_change(feed_t *feed, change_t *c)
+{
+  char *path = malloc(strlen("/source/") + strlen(c->project) + 1 + (c->package ? strlen(c->package) : 0) + 1);
+  int added = feed != &feeds[0];
+  
+  prjinfo_invalidate(c->project);
+  if (c->package) {
+    sprintf(path, "/source/%s/%s", c->project, c->package);
+    invalidate_tree(path);
+    if (added) {
+      /* a new package in the project's listing */
+      sprintf(path, "/source/%s", c->project);
+      dir_cache_invalidate(path);
+    }
+  }
+  else {
+    /* the project's own files and its listing; its packages show up on
+       their own if they have changed */
+    sprintf(path, "/source/%s", c->project);
+    DEBUG("CHANGES: invalidating %s\n", path);
+    dir_cache_invalidate(path);
+    attr_cache_invalidate_prefix(path, 1, drop_fn);
+    if (added)
+      dir_cache_invalidate("/source");
+  }
+  free(path);
+}
+
+/* look at what has changed in "feed" since the last poll */
+static void poll_feed(feed_t *feed)
+{
+  struct feed_parse fp;
+  int i;
+  char *newest = NULL;
+  
+  memset(&fp, 0, sizeof(fp));
+  fp.feed = feed;
+  if (!fetch_feed(&fp) && fp.num_changes) {
+    for (i = 0; i < fp.num_changes; i++) {
+      if (!newest || strcmp(fp.changes[i].time, newest) > 0)
+        newest = fp.changes[i].time;
+    }
+    if (feed->last) {
+      int seen_last = 0;
+      for (i = 0; i < fp.num_changes; i++) {
+        int cmp = strcmp(fp.changes[i].time, feed->last);
+        /* times only have a resolution of a second, so a change in the
+           same second as the newest one we have seen may have come after
+           it; invalidating twice does no harm */
+        if (cmp >= 0)
+          apply_change(feed, &fp.changes[i]);
+        if (cmp < 0)
+          seen_last = 1;
+      }
+      /* everything in the list is new, so there may have been more changes
+         than it holds; we can't tell what they were */
+      if (!seen_last && fp.num_changes >= CHANGES_LIMIT) {
+        DEBUG("CHANGES: too many changes in %s, invalidating everything\n", feed->name);
+        invalidate_tree("/source");
+      }
+    }
+    free(feed->last);
+    feed->last = strdup(newest);
+  }
+  for (i = 0; i < fp.num_changes; i++) {
+    free(fp.changes[i].project);
+    free(fp.changes[i].package);
+    free(fp.changes[i].time);
+  }
+  free(fp.changes);
+}
+
+static void *poller_thread(void *arg)
+{
+  unsigned int i;
+  pthread_mutex_lock(&changes_mutex);
+  while (!shutting_down) {
+    pthread_mutex_unlock(&changes_mutex);
+    for (i = 0; i < sizeof(feeds) / sizeof(feeds[0]); i++)
+      poll_feed(&feeds[i]);
+    
+    pthread_mutex_lock(&changes_mutex);
+    if (shutting_down)
+      break;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += poll_interval;
+    pthread_cond_timedwait(&changes_cond, &changes_mutex, &ts);
+  }
+  pthread_mutex_unlock(&changes_mutex);
+  return NULL;
+}
+
+void changes_init(unsigned int interval, void (*drop)(const char *path))
+{
+  poll_interval = interval;
+  drop_fn = drop;
+  if (!interval)
+    return;
+  shutting_down = 0;
+  if (pthread_create(&poller, NULL, poller_thread, NULL)) {
+    perror("pthread_create");
+    return;
+  }
+  poller_running = 1;
+  dir_cache_set_source_timeout(CHANGES_SOURCE_TIMEOUT);
+}
+
+void changes_destroy(void)
+{
+  unsigned int i;
+  if (!poller_running)
+    return;
+  pthread_mutex_lock(&changes_mutex);
+  shutting_down = 1;
+  pthread_cond_signal(&changes_cond);
+  pthread_mutex_unlock(&changes_mutex);
+  pthread_join(poller, NULL);
+  poller_running = 0;
+  for (i = 0; i < sizeof(feeds) / sizeof(feeds[0]); i++) {
+    free(feeds[i].last);
+    feeds[i].last = NULL;
+  }
+}
@@ -0,0 +1,29 @@
+/*
+ * changes.h
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* change feed
+   With a poll interval set, a background thread watches the server's
+   /statistics/latest_updated and latest_added lists and drops whatever we
+   have cached of the projects and packages that show up there.  Source
+   listings can then be kept much longer than the usual timeout. */
+
+/* "drop" is called for every cached file that is out of date */
+void changes_init(unsigned int interval, void (*drop)(const char *path));
+void changes_destroy(void);
@@ -0,0 +1,581 @@
+/*
+ * commit.c
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "commit.h"
+#include "cache.h"
+#include "util.h"
+#include "status.h"
+#include "http.h"
+#include "writeback.h"
+#include "prjinfo.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <expat.h>
+
+#define DEBUG_COMMIT
+
+#ifdef DEBUG_COMMIT
+#define DEBUG(x...) LOG(LOG_HTTP, LEVEL_DEBUG, x)
+#else
+#define DEBUG(x...)
+#endif
+
+/* one staged change */
+typedef struct {
+  char *name;		/* file name inside the package */
+  char *fs_path;	/* FUSE path, also the name of the local copy */
+  int deleted;		/* file is to be removed from the package */
+  unsigned long gen;	/* write generation of the content uploaded */
+} staged_t;
+
+/* all staged changes of one package */
+typedef struct {
+  char *pkg_path;	/* /source/<project>/<package> */
+  staged_t *files;
+  int num_files;
+  time_t last_change;	/* the commit timer starts over with every change */
+  int attempts;		/* commits that have failed in a row */
+  time_t not_before;	/* back off after a failure */
+  int error;		/* errno of the last failed commit */
+  int failed;		/* given up on until the package is changed again */
+  UT_hash_handle hh;
+} pending_t;
+
+/* entry of a package file list */
+typedef struct {
+  char *name;
+  char *md5;
+} listent_t;
+
+typedef struct {
+  listent_t *entries;
+  int num_entries;
+  int missing;		/* server wants more files before it commits */
+} filelist_t;
+
+static pending_t *pending_hash = NULL;
+static pthread_mutex_t pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* held while a commit is running, so that fsync() cannot return before
+   a commit started by the timer has completed */
+static pthread_mutex_t commit_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int commit_delay = 0;	/* seconds, 0 disables batching */
+static pthread_t commit_thread;
+static pthread_cond_t commit_cond = PTHREAD_COND_INITIALIZER;
+static int commit_stop = 0;
+
+int commit_enabled(void)
+{
+  return commit_delay != 0;
+}
+
+/* split an API path /source/<project>/<package>/<file> into a newly
+   allocated package path and a pointer to the file name; returns NULL if
+   the path does not denote a regular package source file */
+static char *split_package(const char *api_path, const char **name)
+{
+  const char *p;
+  int slashes = 0;
+  if (strncmp(api_path, "/source/", 8))
+    return NULL;
+  for (p = api_path + 8; *p; p++) {
+    if (*p == '/')
+      slashes++;
+  }
+  if (slashes != 2)
+    return NULL;
+  *name = strrchr(api_path, '/') + 1;
+  /* meta data is not part of the package sources */
+  if (!strcmp(*name, "_meta") || !strcmp(*name, "_history") || !**name)
+    return NULL;
+  return strndup(api_path, *name - 1 - api_path);
+}
+
+static void free_staged(staged_t *s)
+{
+  free(s->name);
+  free(s->fs_path);
+}
+
+static void free_pending(pending_t *p)
+{
+  int i;
+  for (i = 0; i < p->num_files; i++)
+    free_staged(&p->files[i]);
+  free(p->files);
+  free(p->pkg_path);
+  free(p);
+}
+
+/* add a change to a package's staging list, replacing any earlier change
+   to the same file unless "keep_newer" is set; pending_mutex must be held */
+static void stage_locked(const char *pkg_path, const char *name, const char *fs_path, int deleted, int keep_newer)
+{
+  pending_t *p;
+  int i;
+  HASH_FIND_STR(pending_hash, pkg_path, p);
+  if (!p) {
+    p = calloc(1, sizeof(pending_t));
+    p->pkg_path = strdup(pkg_path);
+    HASH_ADD_KEYPTR(hh, pending_hash, p->pkg_path, strlen(p->pkg_path), p);
+  }
+  p->last_change = time(NULL);
+  if (!keep_newer) {
+    /* a new change deserves a new try */
+    p->attempts = 0;
+    p->not_before = 0;
+    p->failed = 0;
+  }
+  for (i = 0; i < p->num_files; i++) {
+    if (!strcmp(p->files[i].name, name)) {
+      if (keep_newer)
+        return;
+      free_staged(&p->files[i]);
+      break;
+    }
+  }
+  if (i == p->num_files) {
+    p->files = realloc(p->files, (p->num_files + 1) * sizeof(staged_t));
+    p->num_files++;
+  }
+  p->files[i].name = strdup(name);
+  p->files[i].fs_path = strdup(fs_path);
+  p->files[i].deleted = deleted;
+}
+
+/* stage a modified ("deleted" == 0) or deleted file for the next commit of
+   its package; returns -1 if the file cannot be committed in a batch and
+   has to be uploaded (or deleted) on its own */
+int commit_stage(const char *fs_path, const char *api_path, int deleted)
+{
+  const char *name;
+  char *pkg_path;
+  if (!commit_enabled())
+    return -1;
+  pkg_path = split_package(api_path, &name);
+  if (!pkg_path)
+    return -1;
+  DEBUG("COMMIT: staging %s%s in %s\n", deleted ? "deletion of " : "", name, pkg_path);
+  pthread_mutex_lock(&pending_mutex);
+  stage_locked(pkg_path, name, fs_path, deleted, 0);
+  pthread_mutex_unlock(&pending_mutex);
+  free(pkg_path);
+  return 0;
+}
+
+/* expat tag start handler for file lists and commitfilelist replies */
+static void expat_filelist_start(void *ud, const XML_Char *name, const XML_Char **atts)
+{
+  filelist_t *fl = (filelist_t *)ud;
+  if (!strcmp(name, "directory")) {
+    for (; *atts; atts += 2) {
+      if (!strcmp(atts[0], "error") && !strcmp(atts[1], "missing"))
+        fl->missing = 1;
+    }
+  }
+  else if (!strcmp(name, "entry")) {
+    listent_t le = { NULL, NULL };
+    for (; *atts; atts += 2) {
+      if (!strcmp(atts[0], "name"))
+        le.name = strdup(atts[1]);
+      else if (!strcmp(atts[0], "md5"))
+        le.md5 = strdup(atts[1]);
+    }
+    if (le.name && le.md5) {
+      fl->entries = realloc(fl->entries, (fl->num_entries + 1) * sizeof(listent_t));
+      fl->entries[fl->num_entries++] = le;
+    }
+    else {
+      free(le.name);
+      free(le.md5);
+    }
+  }
+}
+
+static void free_filelist(filelist_t *fl)
+{
+  int i;
+  for (i = 0; i < fl->num_entries; i++) {
+    free(fl->entries[i].name);
+    free(fl->entries[i].md5);
+  }
+  free(fl->entries);
+}
+
+/* data for the write callback that feeds replies to both the status
+   parser and the file list parser */
+struct reply {
+  status_t *status;
+  XML_Parser xp;
+};
+
+static size_t reply_write(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+  struct reply *r = (struct reply *)userdata;
+  xml_status_write(ptr, size, nmemb, r->status);
+  XML_Parse(r->xp, ptr, size * nmemb, 0);
+  return size * nmemb;
+}
+
+/* perform an API request and parse the reply into "fl"; "body" is POSTed
+   if given */
+static int api_filelist(const char *url, const char *body, filelist_t *fl)
+{
+  struct reply r;
+  long code = 0;
+  int ret, s;
+  
+  memset(fl, 0, sizeof(filelist_t));
+  r.status = xml_status_init();
+  r.xp = XML_ParserCreate(NULL);
+  if (!r.xp)
+    abort();
+  XML_SetUserData(r.xp, (void *)fl);
+  XML_SetElementHandler(r.xp, expat_filelist_start, NULL);
+  
+  CURL *curl = curl_open_file(url, NULL, NULL, reply_write, &r);
+  if (body) {
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, strlen(body));
+  }
+  ret = http_perform(curl);
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+  http_close(curl);
+  
+  s = xml_get_status(r.status);
+  /* errors the server doesn't explain */
+  if (!s && !ret && code >= 400) {
+    if (code == 401 || code == 403)
+      s = EPERM;
+    else if (code == 404)
+      s = ENOENT;
+    else if (code < 500)
+      s = EINVAL;
+    else
+      s = EIO;
+  }
+  xml_status_destroy(r.status);
+  XML_ParserFree(r.xp);
+  if (s) {
+    LOG(LOG_HTTP, LEVEL_ERROR, "COMMIT: BS status %d for %s\n", s, url);
+    return -s;
+  }
+  if (ret) {
+    LOG(LOG_HTTP, LEVEL_ERROR, "COMMIT: curl error %d for %s\n", ret, url);
+    return -EIO;
+  }
+  return 0;
+}
+
+/* upload a file to the package's file store without creating a revision */
+static int upload_to_repository(const char *pkg_path, staged_t *sf)
+{
+  int ret;
+  char *api_path = malloc(strlen(pkg_path) + 1 + strlen(sf->name) + 1);
+  sprintf(api_path, "%s/%s", pkg_path, sf->name);
+  ret = writeback_upload(sf->fs_path, api_path, "repository", NULL);
+  free(api_path);
+  return ret;
+}
+
+/* replace, add or remove (md5 == NULL) an entry of a file list */
+static void filelist_set(filelist_t *fl, const char *name, const char *md5)
+{
+  int i;
+  for (i = 0; i < fl->num_entries; i++) {
+    if (!strcmp(fl->entries[i].name, name))
+      break;
+  }
+  if (i == fl->num_entries) {
+    if (!md5)
+      return;
+    fl->entries = realloc(fl->entries, (fl->num_entries + 1) * sizeof(listent_t));
+    fl->entries[i].name = strdup(name);
+    fl->entries[i].md5 = NULL;
+    fl->num_entries++;
+  }
+  free(fl->entries[i].md5);
+  if (md5) {
+    fl->entries[i].md5 = strdup(md5);
+  }
+  else {
+    free(fl->entries[i].name);
+    fl->entries[i] = fl->entries[--fl->num_entries];
+  }
+}
+
+/* create one new source revision containing all staged changes */
+static int do_commit(pending_t *p, const char *comment)
+{
+  filelist_t fl, reply;
+  char md5[MD5_HEX_LEN + 1];
+  int i, ret;
+  
+  DEBUG("COMMIT: committing %d changes to %s\n", p->num_files, p->pkg_path);
+  
+  /* the new revision consists of the current (unexpanded) file list... */
+  char *url = make_url(url_prefix, p->pkg_path, NULL);
+  ret = api_filelist(url, NULL, &fl);
+  free(url);
+  if (ret)
+    return ret;
+  
+  /* ...with the staged changes applied */
+  for (i = 0; i < p->num_files; i++) {
+    staged_t *sf = &p->files[i];
+    if (sf->deleted) {
+      filelist_set(&fl, sf->name, NULL);
+      continue;
+    }
+    /* later writes keep the file modified, see commit_package() */
+    sf->gen = attr_cache_generation(sf->fs_path);
+    if (md5_file(sf->fs_path + 1, md5)) {
+      perror("COMMIT: md5");
+      ret = -EIO;
+      goto out;
+    }
+    if ((ret = upload_to_repository(p->pkg_path, sf)))
+      goto out;
+    filelist_set(&fl, sf->name, md5);
+  }
+  
+  /* compose the commitfilelist request */
+  char *body;
+  size_t len;
+  FILE *bp = open_memstream(&body, &len);
+  fprintf(bp, "<directory>\n");
+  for (i = 0; i < fl.num_entries; i++) {
+    fprintf(bp, "  <entry name=\"");
+    xml_escape(bp, fl.entries[i].name);
+    fprintf(bp, "\" md5=\"%s\" />\n", fl.entries[i].md5);
+  }
+  fprintf(bp, "</directory>\n");
+  fclose(bp);
+  
+  CURL *curl = curl_easy_init();
+  char *esc_comment = curl_easy_escape(curl, comment ? : COMMIT_DEFAULT_COMMENT, 0);
+  curl_easy_cleanup(curl);
+  char *cmd_path = malloc(strlen(p->pkg_path) + strlen("?cmd=commitfilelist&comment=") + strlen(esc_comment) + 1);
+  sprintf(cmd_path, "%s?cmd=commitfilelist&comment=%s", p->pkg_path, esc_comment);
+  curl_free(esc_comment);
+  url = make_url(url_prefix, cmd_path, NULL);
+  free(cmd_path);
+  
+  ret = api_filelist(url, body, &reply);
+  if (!ret && reply.missing) {
+    /* we have uploaded everything we changed, so the server is missing
+       files we did not even touch */
+    LOG(LOG_HTTP, LEVEL_ERROR, "COMMIT: server is missing %d files for %s\n", reply.num_entries, p->pkg_path);
+    ret = -EIO;
+  }
+  free_filelist(&reply);
+  free(url);
+  free(body);
+
+out:
+  free_filelist(&fl);
+  return ret;
+}
+
+/* errors that trying again won't fix: the server has refused the commit */
+static int commit_permanent(int ret)
+{
+  return ret != -EIO && ret != -EBADF;
+}
+
+/* commit all staged changes of the package "pkg_path" now */
+int commit_package(const char *pkg_path, const char *comment)
+{
+  pending_t *p, *q;
+  int i, ret;
+  
+  pthread_mutex_lock(&commit_mutex);
+  pthread_mutex_lock(&pending_mutex);
+  HASH_FIND_STR(pending_hash, pkg_path, p);
+  if (p)
+    HASH_DEL(pending_hash, p);
+  pthread_mutex_unlock(&pending_mutex);
+  
+  if (!p) {
+    pthread_mutex_unlock(&commit_mutex);
+    return 0;
+  }
+  
+  ret = do_commit(p, comment);
+  if (ret) {
+    /* put the changes back so they are retried later, unless they have
+       been superseded in the meantime; if the server has refused them,
+       or we have tried often enough, they stay until the package is
+       changed again or committed explicitly */
+    pthread_mutex_lock(&pending_mutex);
+    for (i = 0; i < p->num_files; i++)
+      stage_locked(p->pkg_path, p->files[i].name, p->files[i].fs_path, p->files[i].deleted, 1);
+    HASH_FIND_STR(pending_hash, p->pkg_path, q);
+    q->error = -ret;
+    q->attempts = p->attempts + 1;
+    q->not_before = time(NULL) + ((time_t)commit_delay << q->attempts);
+    if (commit_permanent(ret) || q->attempts > COMMIT_RETRIES) {
+      LOG(LOG_HTTP, LEVEL_ERROR, "COMMIT: giving up on %s: %s\n", p->pkg_path, strerror(-ret));
+      q->failed = 1;
+    }
+    else
+      LOG(LOG_HTTP, LEVEL_WARN, "COMMIT: committing %s failed, will retry\n", p->pkg_path);
+    pthread_mutex_unlock(&pending_mutex);
+  }
+  else {
+    /* the local copies are in sync with the server now, unless they have
+       been written to since we uploaded them, and the package directory
+       has a new revision */
+    for (i = 0; i < p->num_files; i++) {
+      if (!p->files[i].deleted)
+        attr_cache_clear_modified_gen(p->files[i].fs_path, p->files[i].gen);
+    }
+    for (i = 0; i < p->num_files; i++) {
+      char dn[PATH_MAX];
+      if (!dirname_buf(p->files[i].fs_path, dn, sizeof(dn), NULL))
+        dir_cache_invalidate(dn);
+    }
+    prjinfo_invalidate_path(p->pkg_path);
+  }
+  pthread_mutex_unlock(&commit_mutex);
+  free_pending(p);
+  return ret;
+}
+
+/* commit the package the file "api_path" belongs to */
+int commit_path(const char *api_path, const char *comment)
+{
+  const char *name;
+  char dn[PATH_MAX];
+  char *pkg_path = split_package(api_path, &name);
+  int ret;
+  if (!pkg_path) {
+    /* "_commit" and "_meta" are not package sources, but they can still
+       be used to commit their package */
+    if (dirname_buf(api_path, dn, sizeof(dn), NULL))
+      return -ENAMETOOLONG;
+    return commit_package(dn, comment);
+  }
+  ret = commit_package(pkg_path, comment);
+  free(pkg_path);
+  return ret;
+}
+
+/* commit all packages that have not been changed for commit_delay seconds,
+   or all of them if "all" is set */
+static void commit_due(int all)
+{
+  pending_t *p, *tmp;
+  char **due = NULL;
+  int num_due = 0, i;
+  time_t now = time(NULL);
+  
+  pthread_mutex_lock(&pending_mutex);
+  HASH_ITER(hh, pending_hash, p, tmp) {
+    if (p->failed)
+      continue;
+    if (all || (now - p->last_change >= commit_delay && now >= p->not_before)) {
+      due = realloc(due, (num_due + 1) * sizeof(char *));
+      due[num_due++] = strdup(p->pkg_path);
+    }
+  }
+  pthread_mutex_unlock(&pending_mutex);
+  
+  for (i = 0; i < num_due; i++) {
+    commit_package(due[i], NULL);
+    free(due[i]);
+  }
+  free(due);
+}
+
+static void *commit_timer(void *arg)
+{
+  struct timespec ts;
+  pthread_mutex_lock(&pending_mutex);
+  while (!commit_stop) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec++;
+    pthread_cond_timedwait(&commit_cond, &pending_mutex, &ts);
+    if (commit_stop)
+      break;
+    pthread_mutex_unlock(&pending_mutex);
+    commit_due(0);
+    pthread_mutex_lock(&pending_mutex);
+  }
+  pthread_mutex_unlock(&pending_mutex);
+  return NULL;
+}
+
+/* enable batched commits, committing each package "delay" seconds after
+   the last change to it */
+void commit_init(unsigned int delay)
+{
+  commit_delay = delay;
+  if (!commit_delay)
+    return;
+  commit_stop = 0;
+  if (pthread_create(&commit_thread, NULL, commit_timer, NULL)) {
+    perror("pthread_create");
+    abort();
+  }
+}
+
+/* write a human-readable list of packages with uncommitted changes to "fp" */
+void commit_report(FILE *fp)
+{
+  pending_t *p, *tmp;
+  pthread_mutex_lock(&pending_mutex);
+  HASH_ITER(hh, pending_hash, p, tmp) {
+    fprintf(fp, "%-7s %s (%d files)", p->failed ? "failed" : "pending", p->pkg_path, p->num_files);
+    if (p->error)
+      fprintf(fp, ": %s", strerror(p->error));
+    if (p->attempts && !p->failed)
+      fprintf(fp, ", retry %d of %d", p->attempts, COMMIT_RETRIES);
+    fputc('\n', fp);
+  }
+  pthread_mutex_unlock(&pending_mutex);
+}
+
+/* stop the timer and commit everything that is still pending */
+void commit_destroy(void)
+{
+  if (!commit_delay)
+    return;
+  pthread_mutex_lock(&pending_mutex);
+  commit_stop = 1;
+  pthread_cond_signal(&commit_cond);
+  pthread_mutex_unlock(&pending_mutex);
+  pthread_join(commit_thread, NULL);
+  
+  commit_due(1);
+  
+  pending_t *p, *tmp;
+  HASH_ITER(hh, pending_hash, p, tmp) {
+    LOG(LOG_HTTP, LEVEL_ERROR, "COMMIT: discarding uncommitted changes to %s\n", p->pkg_path);
+    HASH_DEL(pending_hash, p);
+    free_pending(p);
+  }
+}
@@ -0,0 +1,41 @@
+/*
+ * commit.h
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+
+/* batched source commits
+   Instead of creating one source revision per modified or deleted file,
+   changes below /source/<project>/<package> are staged per package and
+   committed together using the commitfilelist API call. */
+
+#define COMMIT_NODE "_commit"
+#define COMMIT_DEFAULT_COMMENT "committed by obsfs"
+/* failed commits are retried after commit_delay, twice that, and so on,
+   this many times; commits the server refuses are not retried at all */
+#define COMMIT_RETRIES 4
+
+void commit_init(unsigned int delay);
+void commit_destroy(void);
+int commit_enabled(void);
+
+int commit_stage(const char *fs_path, const char *api_path, int deleted);
+int commit_package(const char *pkg_path, const char *comment);
+int commit_path(const char *api_path, const char *comment);
+void commit_report(FILE *fp);
@@ -0,0 +1,240 @@
+/*
+ * http.c
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "http.h"
+#include "obsfs.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+//#define DEBUG_HTTP
+
+#ifdef DEBUG_HTTP
+#define DEBUG(x...) LOG(LOG_HTTP, LEVEL_DEBUG, x)
+#else
+#define DEBUG(x...)
+#endif
+
+char *url_prefix = NULL;	/* prefix for API calls (https://...) */
+
+static const char *api_username;
+static const char *api_password;
+
+/* All handles share cookies, DNS results and TLS sessions.  Cookies live
+   in memory and are only written to the jar now and then, instead of every
+   handle reading and rewriting it.  Connections can't be shared between
+   threads, so every thread keeps its last handle, and the connections
+   that come with it, for its next request instead (see http_close()). */
+static CURLSH *share = NULL;
+static pthread_mutex_t share_mutex[CURL_LOCK_DATA_LAST];
+static __thread CURL *idle_handle = NULL;
+static pthread_key_t idle_key;
+
+/* guarded by cookie_mutex */
+static int have_session = 0;	/* we hold a session cookie */
+static time_t cookies_saved;	/* last time the jar was written */
+static pthread_mutex_t cookie_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int session(void)
+{
+  int ret;
+  pthread_mutex_lock(&cookie_mutex);
+  ret = have_session;
+  pthread_mutex_unlock(&cookie_mutex);
+  return ret;
+}
+
+static void share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+  pthread_mutex_lock(&share_mutex[data]);
+}
+
+static void share_unlock(CURL *handle, curl_lock_data data, void *userptr)
+{
+  pthread_mutex_unlock(&share_mutex[data]);
+}
+
+/* pthread_key destructor: close the connections of an exiting thread */
+static void idle_exit(void *p)
+{
+  idle_handle = NULL;
+  curl_easy_cleanup(p);
+}
+
+/* write the in-memory cookies to the jar */
+static void save_cookies(void)
+{
+  CURL *curl = curl_easy_init();
+  curl_easy_setopt(curl, CURLOPT_SHARE, share);
+  curl_easy_setopt(curl, CURLOPT_COOKIEJAR, COOKIE_JAR);
+  curl_easy_setopt(curl, CURLOPT_COOKIELIST, "FLUSH");
+  curl_easy_setopt(curl, CURLOPT_COOKIEJAR, NULL);
+  curl_easy_cleanup(curl);
+  cookies_saved = time(NULL);
+}
+
+/* Is there a session cookie among the ones "curl" knows about?  Once we
+   have one, there is no need to send our credentials up front anymore. */
+static int find_session(CURL *curl)
+{
+  struct curl_slist *cookies, *c;
+  int found = 0;
+  if (curl_easy_getinfo(curl, CURLINFO_COOKIELIST, &cookies) != CURLE_OK)
+    return 0;
+  for (c = cookies; c && !found; c = c->next) {
+    /* Netscape format, the name is the sixth field */
+    const char *name = c->data;
+    int field;
+    for (field = 0; field < 5 && name; field++) {
+      name = strchr(name, '\t');
+      if (name)
+        name++;
+    }
+    if (name && strcasestr(name, "session"))
+      found = 1;
+  }
+  curl_slist_free_all(cookies);
+  return found;
+}
+
+/* construct the URL prefix from the API server host name and remember
+   the credentials for later requests */
+void http_init(const char *host, const char *username, const char *password)
+{
+  int i;
+  url_prefix = malloc(strlen(host) + strlen("https://") + 1);
+  sprintf(url_prefix, "https://%s", host);
+  api_username = username;
+  api_password = password;
+  
+  for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+    pthread_mutex_init(&share_mutex[i], NULL);
+  share = curl_share_init();
+  curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+  curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_COOKIE);
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  pthread_key_create(&idle_key, idle_exit);
+  
+  /* load the cookies from the last session, once */
+  CURL *curl = curl_easy_init();
+  curl_easy_setopt(curl, CURLOPT_SHARE, share);
+  curl_easy_setopt(curl, CURLOPT_COOKIEFILE, COOKIE_JAR);
+  curl_easy_setopt(curl, CURLOPT_COOKIELIST, "RELOAD");
+  have_session = find_session(curl);
+  curl_easy_cleanup(curl);
+  cookies_saved = time(NULL);
+}
+
+void http_destroy(void)
+{
+  int i;
+  if (idle_handle) {
+    curl_easy_cleanup(idle_handle);
+    idle_handle = NULL;
+  }
+  save_cookies();
+  /* the threads that made requests should be gone by now, and their idle
+     handles with them; if one isn't, the share has to stay */
+  if (curl_share_cleanup(share) != CURLSHE_OK) {
+    LOG(LOG_HTTP, LEVEL_WARN, "HTTP: connection share still in use\n");
+  }
+  else {
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+      pthread_mutex_destroy(&share_mutex[i]);
+  }
+  share = NULL;
+  free(url_prefix);
+  url_prefix = NULL;
+}
+
+/* initialize curl and set API user name and password, writer function and
+   user data; the handle is to be given back with http_close() */
+CURL *curl_open_file(const char *url, void *read_fun, void *read_data, void *write_fun, void *write_data)
+{
+  CURL *curl = idle_handle;
+  if (curl) {
+    /* keeps the connections, forgets everything else */
+    idle_handle = NULL;
+    curl_easy_reset(curl);
+  }
+  else
+    curl = curl_easy_init();
+  curl_easy_setopt(curl, CURLOPT_URL, url);
+  curl_easy_setopt(curl, CURLOPT_USERNAME, api_username);
+  curl_easy_setopt(curl, CURLOPT_PASSWORD, api_password);
+  if (session()) {
+    /* only authenticate if the server asks for it, i.e. if the session
+       has expired */
+    curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC | CURLAUTH_ONLY);
+  }
+  curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_fun);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_fun);
+  curl_easy_setopt(curl, CURLOPT_READDATA, read_data);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, write_data);
+  curl_easy_setopt(curl, CURLOPT_SHARE, share);
+  curl_easy_setopt(curl, CURLOPT_COOKIEFILE, ""); /* start cookie engine */
+  return curl;
+}
+
+/* perform a request, keeping track of the session cookie and saving the
+   cookie jar every once in a while */
+CURLcode http_perform(CURL *curl)
+{
+  CURLcode ret = curl_easy_perform(curl);
+  
+  int found = !session() && find_session(curl);
+  
+  pthread_mutex_lock(&cookie_mutex);
+  if (found && !have_session) {
+    DEBUG("HTTP: got a session cookie\n");
+    have_session = 1;
+  }
+  if (time(NULL) - cookies_saved > COOKIE_SAVE_INTERVAL)
+    save_cookies();
+  pthread_mutex_unlock(&cookie_mutex);
+  return ret;
+}
+
+/* done with a handle from curl_open_file(); the thread keeps it for its
+   next request */
+void http_close(CURL *curl)
+{
+  if (idle_handle) {
+    curl_easy_cleanup(curl);
+    return;
+  }
+  idle_handle = curl;
+  pthread_setspecific(idle_key, curl);
+}
+
+/* Giving it a NULL pointer as the reader function doesn't deter curl from
+   using fwrite() anyway, so we need this expceptionally useless function. */
+size_t write_null(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+  (void)ptr;
+  (void)userdata;
+  return size * nmemb;
+}
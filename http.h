@@ -0,0 +1,31 @@
+/*
+ * http.h
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <curl/curl.h>
+
+extern char *url_prefix;	/* prefix for API calls (https://...) */
+
+void http_init(const char *host, const char *username, const char *password);
+void http_destroy(void);
+
+CURL *curl_open_file(const char *url, void *read_fun, void *read_data, void *write_fun, void *write_data);
+CURLcode http_perform(CURL *curl);
+void http_close(CURL *curl);
+size_t write_null(void *ptr, size_t size, size_t nmemb, void *userdata);
@@ -0,0 +1,312 @@
+/*
+ * log.c
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "log.h"
+#include "obsfs.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+static const char *subsys_names[LOG_SUBSYSTEMS] = {
+  "fuse", "cache", "http", "xml", "bg"
+};
+
+static const char *level_names[] = {
+  "error", "warn", "info", "debug", NULL
+};
+
+int log_levels[LOG_SUBSYSTEMS] = {
+  LEVEL_WARN, LEVEL_WARN, LEVEL_WARN, LEVEL_WARN, LEVEL_WARN
+};
+
+/* Every thread that logs something gets a ring of its own.  "head" is
+   only advanced by that thread and "tail" only by the writer, so they
+   need no lock between them. */
+typedef struct ring {
+  struct ring *next;
+  unsigned int head;	/* next line to be written by the thread */
+  unsigned int tail;	/* next line to be written out by the writer */
+  unsigned long dropped;	/* lines that didn't fit */
+  unsigned long reported;	/* drops the writer has told about */
+  int dead;		/* the thread has exited */
+  long tid;
+  char lines[LOG_RING_SIZE][LOG_LINE_MAX];
+} ring_t;
+
+static __thread ring_t *my_ring = NULL;
+static pthread_key_t ring_key;
+static ring_t *rings = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int running = 0;
+static int stopping;
+static pthread_t writer_thread;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+
+/* pthread_key destructor: the writer frees the ring once it is empty */
+static void ring_exit(void *p)
+{
+  ring_t *r = p;
+  my_ring = NULL;
+  __atomic_store_n(&r->dead, 1, __ATOMIC_RELEASE);
+}
+
+static ring_t *get_ring(void)
+{
+  if (my_ring)
+    return my_ring;
+  my_ring = calloc(1, sizeof(ring_t));
+  if (!my_ring)
+    return NULL;
+  my_ring->tid = syscall(SYS_gettid);
+  pthread_setspecific(ring_key, my_ring);
+  pthread_mutex_lock(&rings_mutex);
+  my_ring->next = rings;
+  rings = my_ring;
+  pthread_mutex_unlock(&rings_mutex);
+  return my_ring;
+}
+
+/* use LOG() instead, which skips this for messages that aren't wanted */
+void log_msg(int subsys, int level, const char *fmt, ...)
+{
+  va_list ap;
+  ring_t *r;
+  unsigned int head;
+  struct timespec ts;
+  char *line;
+  int len;
+  
+  va_start(ap, fmt);
+  /* before the writer has started and after it has stopped, we are on our
+     own */
+  if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE) || !(r = get_ring())) {
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    return;
+  }
+  head = r->head;
+  if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE) {
+    __atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+    va_end(ap);
+    return;
+  }
+  line = r->lines[head % LOG_RING_SIZE];
+  clock_gettime(CLOCK_REALTIME, &ts);
+  len = snprintf(line, LOG_LINE_MAX, "%ld.%03ld %ld %s %s: ", (long)ts.tv_sec, ts.tv_nsec / 1000000,
+                 r->tid, subsys_names[subsys], level_names[level]);
+  vsnprintf(line + len, LOG_LINE_MAX - len, fmt, ap);
+  va_end(ap);
+  __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* output buffer of the writer */
+static char out[65536];
+static size_t out_len;
+
+static void out_flush(void)
+{
+  size_t done = 0;
+  ssize_t ret;
+  while (done < out_len) {
+    ret = write(STDERR_FILENO, out + done, out_len - done);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      break;
+    done += ret;
+  }
+  out_len = 0;
+}
+
+static void out_line(const char *line)
+{
+  size_t len = strlen(line);
+  if (out_len + len + 1 > sizeof(out))
+    out_flush();
+  memcpy(out + out_len, line, len);
+  out_len += len;
+  /* long lines are cut off, including their newline */
+  if (!len || line[len - 1] != '\n')
+    out[out_len++] = '\n';
+}
+
+/* write out what the threads have logged, and free the rings of those
+   that have exited */
+static void drain(void)
+{
+  ring_t *r, **prev;
+  unsigned int tail, head;
+  unsigned long dropped;
+  char note[80];
+  
+  pthread_mutex_lock(&rings_mutex);
+  for (prev = &rings; (r = *prev); ) {
+    int dead = __atomic_load_n(&r->dead, __ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    for (tail = r->tail; tail != head; tail++)
+      out_line(r->lines[tail % LOG_RING_SIZE]);
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+    if (dropped != r->reported) {
+      snprintf(note, sizeof(note), "LOG: %lu messages of thread %ld dropped\n", dropped - r->reported, r->tid);
+      out_line(note);
+      r->reported = dropped;
+    }
+    if (dead) {
+      *prev = r->next;
+      free(r);
+    }
+    else
+      prev = &r->next;
+  }
+  pthread_mutex_unlock(&rings_mutex);
+  out_flush();
+}
+
+static void *writer(void *arg)
+{
+  struct timespec ts;
+  int stop;
+  for (;;) {
+    pthread_mutex_lock(&writer_mutex);
+    if (!stopping) {
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += LOG_FLUSH_INTERVAL * 1000000L;
+      ts.tv_sec += ts.tv_nsec / 1000000000L;
+      ts.tv_nsec %= 1000000000L;
+      pthread_cond_timedwait(&writer_cond, &writer_mutex, &ts);
+    }
+    stop = stopping;
+    pthread_mutex_unlock(&writer_mutex);
+    drain();
+    if (stop)
+      break;
+  }
+  return NULL;
+}
+
+/* Set log levels from "spec", a list of settings separated by commas or
+   white space.  A setting is either "<subsystem>=<level>" or just a level
+   for all subsystems, the levels being "off", "error", "warn", "info", and
+   "debug".  Anything from a "#" to the end of the line is ignored, so what
+   log_report() writes can be read back.  Returns -1 without changing
+   anything if "spec" doesn't make sense. */
+int log_set(const char *spec)
+{
+  int levels[LOG_SUBSYSTEMS];
+  const char *p = spec, *end, *eq, *lname;
+  int i, level;
+  
+  memcpy(levels, log_levels, sizeof(levels));
+  while (*p) {
+    if (*p == '#') {
+      p = strchrnul(p, '\n');
+      continue;
+    }
+    if (*p == ',' || *p == ' ' || *p == '\t' || *p == '\n') {
+      p++;
+      continue;
+    }
+    end = p + strcspn(p, ", \t\n#");
+    eq = memchr(p, '=', end - p);
+    lname = eq ? eq + 1 : p;
+    if (end - lname == 3 && !strncasecmp(lname, "off", 3))
+      level = LEVEL_OFF;
+    else {
+      for (level = 0; level_names[level]; level++) {
+        if ((size_t)(end - lname) == strlen(level_names[level]) && !strncasecmp(lname, level_names[level], end - lname))
+          break;
+      }
+      if (!level_names[level])
+        return -1;
+    }
+    if (!eq) {
+      for (i = 0; i < LOG_SUBSYSTEMS; i++)
+        levels[i] = level;
+    }
+    else {
+      for (i = 0; i < LOG_SUBSYSTEMS; i++) {
+        if ((size_t)(eq - p) == strlen(subsys_names[i]) && !strncasecmp(p, subsys_names[i], eq - p))
+          break;
+      }
+      if (i == LOG_SUBSYSTEMS)
+        return -1;
+      levels[i] = level;
+    }
+    p = end;
+  }
+  for (i = 0; i < LOG_SUBSYSTEMS; i++)
+    __atomic_store_n(&log_levels[i], levels[i], __ATOMIC_RELAXED);
+  return 0;
+}
+
+/* write the current log levels to "fp", in a form log_set() takes */
+void log_report(FILE *fp)
+{
+  ring_t *r;
+  int i, threads = 0;
+  unsigned long dropped = 0;
+  
+  for (i = 0; i < LOG_SUBSYSTEMS; i++)
+    fprintf(fp, "%s=%s\n", subsys_names[i], log_levels[i] == LEVEL_OFF ? "off" : level_names[log_levels[i]]);
+  pthread_mutex_lock(&rings_mutex);
+  for (r = rings; r; r = r->next) {
+    threads++;
+    dropped += r->dropped;
+  }
+  pthread_mutex_unlock(&rings_mutex);
+  fprintf(fp, "# %d threads logging, %lu messages dropped\n", threads, dropped);
+}
+
+/* start writing messages in the background */
+int log_init(void)
+{
+  if (pthread_key_create(&ring_key, ring_exit))
+    return -1;
+  stopping = 0;
+  if (pthread_create(&writer_thread, NULL, writer, NULL)) {
+    perror("pthread_create");
+    return -1;
+  }
+  __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* write out what is left and go back to writing messages directly */
+void log_destroy(void)
+{
+  if (!running)
+    return;
+  __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&writer_mutex);
+  stopping = 1;
+  pthread_cond_signal(&writer_cond);
+  pthread_mutex_unlock(&writer_mutex);
+  pthread_join(writer_thread, NULL);
+}
@@ -0,0 +1,58 @@
+/*
+ * log.h
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+
+/* leveled logging
+   Messages are kept apart by the subsystem they come from, each of which
+   has its own level that can be changed at any time (see log_set()).  A
+   message above its subsystem's level costs one comparison.  Those that
+   are logged go to a ring buffer of the calling thread, without taking any
+   locks, and a background thread writes them to stderr every
+   LOG_FLUSH_INTERVAL ms.  If a thread logs faster than that, its messages
+   are dropped and counted. */
+
+enum log_subsys {
+  LOG_FUSE,	/* file system operations */
+  LOG_CACHE,	/* attribute, directory, and file caches */
+  LOG_HTTP,	/* requests to the server, uploads, and commits */
+  LOG_XML,	/* parsing of server responses */
+  LOG_BG,	/* background jobs: prefetching, watchers, build logs */
+  LOG_SUBSYSTEMS
+};
+
+enum log_level {
+  LEVEL_OFF = -1,
+  LEVEL_ERROR,
+  LEVEL_WARN,
+  LEVEL_INFO,
+  LEVEL_DEBUG
+};
+
+extern int log_levels[LOG_SUBSYSTEMS];
+
+#define LOG(subsys, level, x...) \
+  do { if ((level) <= log_levels[subsys]) log_msg(subsys, level, x); } while (0)
+
+void log_msg(int subsys, int level, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+int log_set(const char *spec);
+void log_report(FILE *fp);
+int log_init(void);
+void log_destroy(void);
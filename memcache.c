@@ -0,0 +1,248 @@
+/*
+ * memcache.c
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "memcache.h"
+#include "util.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <pthread.h>
+
+#define MEMCACHE_DEBUG
+
+#ifdef MEMCACHE_DEBUG
+#define DEBUG(x...) LOG(LOG_CACHE, LEVEL_DEBUG, x)
+#else
+#define DEBUG(x...)
+#endif
+
+/* uthash keeps entries in insertion order, and we re-insert them whenever
+   they are used, so the head of the list is the least recently used one */
+static mem_t *mem_hash = NULL;
+static size_t mem_bytes = 0;		/* currently in use */
+static size_t mem_max_bytes = 0;	/* 0 disables the memory cache */
+static size_t mem_max_file = 0;
+static pthread_mutex_t mem_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void memcache_init(size_t max_bytes, size_t max_file)
+{
+  mem_max_bytes = max_bytes;
+  mem_max_file = max_bytes ? max_file : 0;
+}
+
+/* size limit for files that may be kept in memory, 0 if disabled */
+size_t memcache_max_file(void)
+{
+  return mem_max_file;
+}
+
+static void free_mem(mem_t *m)
+{
+  mem_bytes -= m->len;
+  free(m->path);
+  free(m->data);
+  free(m);
+}
+
+/* write an entry to the file cache directory; it goes to a temporary
+   file first, so that nobody finds half of it there */
+static int write_out(mem_t *m)
+{
+  const char *relpath = m->path + 1;	/* skip leading slash */
+  char tmp[strlen(relpath) + 18];
+  struct utimbuf ut;
+  snprintf(tmp, sizeof(tmp), "%s.%lx", relpath, (unsigned long)pthread_self());
+  if (mkdirp(relpath, 0755))
+    return -1;
+  FILE *fp = fopen(tmp, "w");
+  if (!fp)
+    return -1;
+  if (fwrite(m->data, 1, m->len, fp) != m->len) {
+    fclose(fp);
+    unlink(tmp);
+    return -1;
+  }
+  if (fclose(fp)) {
+    unlink(tmp);
+    return -1;
+  }
+  /* keep the original retrieval time so that the file cache timeout works */
+  ut.actime = ut.modtime = m->timestamp;
+  utime(tmp, &ut);
+  if (rename(tmp, relpath)) {
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+/* make room for "len" more bytes; mem_mutex must be held.  The entries
+   taken out of the cache are returned as a list, to be written out by
+   write_evicted() once mem_mutex has been released. */
+static mem_t *evict(size_t len)
+{
+  mem_t *m, *tmp, *evicted = NULL;
+  HASH_ITER(hh, mem_hash, m, tmp) {
+    if (mem_bytes + len <= mem_max_bytes)
+      break;
+    if (m->refs)
+      continue;
+    DEBUG("MEMCACHE: evicting %s\n", m->path);
+    HASH_DEL(mem_hash, m);
+    mem_bytes -= m->len;
+    m->next = evicted;
+    evicted = m;
+  }
+  return evicted;
+}
+
+static void write_evicted(mem_t *evicted)
+{
+  mem_t *m;
+  while ((m = evicted)) {
+    evicted = m->next;
+    write_out(m);
+    free(m->path);
+    free(m->data);
+    free(m);
+  }
+}
+
+/* retrieve an entry and take a reference to it */
+mem_t *memcache_get(const char *path)
+{
+  mem_t *m;
+  pthread_mutex_lock(&mem_mutex);
+  HASH_FIND_STR(mem_hash, path, m);
+  if (m) {
+    /* move to the end of the LRU list */
+    HASH_DEL(mem_hash, m);
+    HASH_ADD_KEYPTR(hh, mem_hash, m->path, strlen(m->path), m);
+    m->refs++;
+  }
+  pthread_mutex_unlock(&mem_mutex);
+  return m;
+}
+
+/* add "data" (which the cache takes ownership of) as the contents of
+   "path" and return a reference to the new entry */
+mem_t *memcache_put(const char *path, char *data, size_t len)
+{
+  mem_t *m, *evicted;
+  pthread_mutex_lock(&mem_mutex);
+  HASH_FIND_STR(mem_hash, path, m);
+  if (m && !m->refs) {
+    HASH_DEL(mem_hash, m);
+    free_mem(m);
+  }
+  else if (m) {
+    /* still in use, so it lives on outside the hash until released */
+    HASH_DEL(mem_hash, m);
+    m->removed = 1;
+  }
+  evicted = evict(len);
+  m = calloc(1, sizeof(mem_t));
+  m->path = strdup(path);
+  m->data = data;
+  m->len = len;
+  m->timestamp = time(NULL);
+  m->refs = 1;
+  mem_bytes += len;
+  HASH_ADD_KEYPTR(hh, mem_hash, m->path, strlen(m->path), m);
+  pthread_mutex_unlock(&mem_mutex);
+  write_evicted(evicted);
+  return m;
+}
+
+void memcache_release(mem_t *m)
+{
+  mem_t *evicted = NULL;
+  pthread_mutex_lock(&mem_mutex);
+  if (!--m->refs) {
+    if (m->removed)
+      free_mem(m);	/* replaced or removed while it was open */
+    else if (mem_bytes > mem_max_bytes)
+      evicted = evict(0);
+  }
+  pthread_mutex_unlock(&mem_mutex);
+  write_evicted(evicted);
+}
+
+static void remove_locked(mem_t *m)
+{
+  HASH_DEL(mem_hash, m);
+  if (m->refs)
+    m->removed = 1;
+  else
+    free_mem(m);
+}
+
+/* move an entry to the file cache directory, because somebody is about to
+   modify it; returns 0 if there was nothing to do */
+int memcache_spill(const char *path)
+{
+  mem_t *m;
+  int ret = 0;
+  pthread_mutex_lock(&mem_mutex);
+  HASH_FIND_STR(mem_hash, path, m);
+  if (m) {
+    DEBUG("MEMCACHE: spilling %s\n", path);
+    ret = write_out(m);
+    remove_locked(m);
+  }
+  pthread_mutex_unlock(&mem_mutex);
+  return ret;
+}
+
+void memcache_remove(const char *path)
+{
+  mem_t *m;
+  pthread_mutex_lock(&mem_mutex);
+  HASH_FIND_STR(mem_hash, path, m);
+  if (m)
+    remove_locked(m);
+  pthread_mutex_unlock(&mem_mutex);
+}
+
+/* get the size of a file held in memory; returns -1 if there is none */
+int memcache_size(const char *path, off_t *size)
+{
+  mem_t *m;
+  pthread_mutex_lock(&mem_mutex);
+  HASH_FIND_STR(mem_hash, path, m);
+  if (m)
+    *size = m->len;
+  pthread_mutex_unlock(&mem_mutex);
+  return m ? 0 : -1;
+}
+
+void memcache_free(void)
+{
+  mem_t *m, *tmp;
+  pthread_mutex_lock(&mem_mutex);
+  HASH_ITER(hh, mem_hash, m, tmp) {
+    remove_locked(m);
+  }
+  pthread_mutex_unlock(&mem_mutex);
+}
@@ -0,0 +1,51 @@
+/*
+ * memcache.h
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+#include "uthash.h"
+
+/* in-memory file cache
+   Small files are kept in memory instead of the file cache directory.  They
+   are written to the file cache only when they are opened for writing or
+   evicted to make room for others. */
+
+typedef struct mem {
+  char *path;
+  char *data;
+  size_t len;
+  time_t timestamp;	/* time of retrieval */
+  int refs;		/* open file handles */
+  int removed;		/* no longer in the cache, free when released */
+  struct mem *next;	/* evicted entries waiting to be written out */
+  UT_hash_handle hh;
+} mem_t;
+
+void memcache_init(size_t max_bytes, size_t max_file);
+void memcache_free(void);
+size_t memcache_max_file(void);
+
+mem_t *memcache_get(const char *path);
+mem_t *memcache_put(const char *path, char *data, size_t len);
+void memcache_release(mem_t *m);
+int memcache_spill(const char *path);
+void memcache_remove(const char *path);
+int memcache_size(const char *path, off_t *size);
@@ -0,0 +1,245 @@
+/*
+ * names.c
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "names.h"
+#include "log.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NAMES_DEBUG
+
+#ifdef NAMES_DEBUG
+#define DEBUG(x...) LOG(LOG_CACHE, LEVEL_DEBUG, x)
+#else
+#define DEBUG(x...)
+#endif
+
+/* an interned name, shared by all the nodes it names */
+typedef struct {
+  int refs;
+  UT_hash_handle hh;
+  char str[];
+} atom_t;
+
+static atom_t *atom_hash = NULL;
+static size_t atom_bytes = 0;
+static name_t root = { .name = "" };
+static size_t num_nodes = 0;
+
+static const char *intern(const char *name, size_t len)
+{
+  atom_t *a;
+  HASH_FIND(hh, atom_hash, name, len, a);
+  if (!a) {
+    a = malloc(sizeof(atom_t) + len + 1);
+    a->refs = 0;
+    memcpy(a->str, name, len);
+    a->str[len] = 0;
+    HASH_ADD_KEYPTR(hh, atom_hash, a->str, len, a);
+    atom_bytes += sizeof(atom_t) + len + 1;
+  }
+  a->refs++;
+  return a->str;
+}
+
+static void unintern(const char *str)
+{
+  atom_t *a = (atom_t *)(str - offsetof(atom_t, str));
+  if (--a->refs)
+    return;
+  HASH_DEL(atom_hash, a);
+  atom_bytes -= sizeof(atom_t) + strlen(a->str) + 1;
+  free(a);
+}
+
+name_t *names_root(void)
+{
+  return &root;
+}
+
+/* the child "name" (of length "len") of "parent"; with "create" set, it is
+   made if it doesn't exist yet */
+name_t *names_child(name_t *parent, const char *name, size_t len, int create)
+{
+  name_t *n;
+  HASH_FIND(hh, parent->children, name, len, n);
+  if (!n && create) {
+    n = calloc(1, sizeof(name_t));
+    n->name = intern(name, len);
+    n->parent = parent;
+    HASH_ADD_KEYPTR(hh, parent->children, n->name, len, n);
+    num_nodes++;
+  }
+  return n;
+}
+
+/* walk down "path" as far as we can; "*rest" is set to the components we
+   didn't find */
+static name_t *walk(const char *path, int create, const char **rest)
+{
+  name_t *n = names_root(), *c;
+  const char *end;
+  
+  for (;;) {
+    while (*path == '/')
+      path++;
+    if (!*path)
+      break;
+    end = strchrnul(path, '/');
+    c = names_child(n, path, end - path, create);
+    if (!c)
+      break;
+    n = c;
+    path = end;
+  }
+  *rest = path;
+  return n;
+}
+
+/* the node for "path", or NULL if there is none and "create" isn't set */
+name_t *names_lookup(const char *path, int create)
+{
+  const char *rest;
+  name_t *n = walk(path, create, &rest);
+  return *rest ? NULL : n;
+}
+
+/* the node for "path", or that of its closest ancestor we have */
+name_t *names_closest(const char *path)
+{
+  const char *rest;
+  return walk(path, 0, &rest);
+}
+
+/* full path of a node, to be free()d by the caller */
+char *names_path(name_t *n)
+{
+  name_t *p;
+  size_t len = 0;
+  char *path, *c;
+  
+  if (n == &root)
+    return strdup("/");
+  for (p = n; p != &root; p = p->parent)
+    len += strlen(p->name) + 1;
+  path = malloc(len + 1);
+  c = path + len;
+  *c = 0;
+  for (p = n; p != &root; p = p->parent) {
+    size_t l = strlen(p->name);
+    c -= l;
+    memcpy(c, p->name, l);
+    *--c = '/';
+  }
+  return path;
+}
+
+/* Nodes are kept as long as they have a cache entry, children, or
+   something to remember about their subtree. */
+static int unused(name_t *n)
+{
+  return n != &root && !n->attr && !n->dir && !n->children && !n->gen && !n->ttl;
+}
+
+static void free_node(name_t *n)
+{
+  HASH_DEL(n->parent->children, n);
+  unintern(n->name);
+  free(n);
+  num_nodes--;
+}
+
+/* free "n" if nothing is left in it, and then its ancestors that become
+   empty that way */
+void names_release(name_t *n)
+{
+  name_t *p;
+  while (unused(n)) {
+    p = n->parent;
+    free_node(n);
+    n = p;
+  }
+}
+
+static void prune_below(name_t *n)
+{
+  name_t *c, *tmp;
+  HASH_ITER(hh, n->children, c, tmp) {
+    prune_below(c);
+    if (unused(c))
+      free_node(c);
+  }
+}
+
+/* free the empty nodes below "n", then "n" itself if it's empty, too */
+void names_prune(name_t *n)
+{
+  prune_below(n);
+  names_release(n);
+}
+
+/* bytes in the hash tables (not their entries) of "head" */
+#define TABLE_BYTES(head) ((head) ? sizeof(UT_hash_table) + (head)->hh.tbl->num_buckets * sizeof(UT_hash_bucket) : 0)
+
+/* add up the memory used by the subtree of "n", and the length of the full
+   paths we would otherwise store for it ("len" being that of "n" itself) */
+static void count(name_t *n, size_t len, size_t *tables, size_t *paths)
+{
+  name_t *c, *tmp;
+  *tables += TABLE_BYTES(n->children);
+  HASH_ITER(hh, n->children, c, tmp) {
+    size_t clen = len + 1 + strlen(c->name);
+    *paths += clen + 1;
+    count(c, clen, tables, paths);
+  }
+}
+
+/* write statistics on the namespace to "fp" */
+void names_report(FILE *fp)
+{
+  size_t tables = 0, paths = 0, bytes, names;
+  
+  count(&root, 0, &tables, &paths);
+  bytes = num_nodes * sizeof(name_t) + tables;
+  names = atom_bytes + TABLE_BYTES(atom_hash);
+  fprintf(fp, "nodes: %zu (%zu bytes each)\n", num_nodes, sizeof(name_t));
+  fprintf(fp, "names: %u (%zu bytes)\n", HASH_COUNT(atom_hash), names);
+  fprintf(fp, "nodes and child tables: %zu bytes\n", bytes);
+  fprintf(fp, "bytes per node: %zu\n", num_nodes ? (bytes + names) / num_nodes : 0);
+  fprintf(fp, "full paths would take: %zu bytes\n", paths);
+}
+
+static void free_tree(name_t *n)
+{
+  name_t *c, *tmp;
+  HASH_ITER(hh, n->children, c, tmp) {
+    free_tree(c);
+    free_node(c);
+  }
+}
+
+/* free() all nodes; the caches must have dropped their entries already */
+void names_free(void)
+{
+  free_tree(&root);
+  DEBUG("NAMES: %u names left after freeing all nodes\n", HASH_COUNT(atom_hash));
+}
@@ -0,0 +1,60 @@
+/*
+ * names.h
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "uthash.h"
+
+/* path namespace
+   Every path the caches know about is a chain of nodes, one per path
+   component, each pointing to its parent and holding its children in a
+   hash keyed by their names, so finding a node only ever hashes single
+   components.  The names themselves are interned: a project or package
+   name is stored once, no matter how often it occurs below /build, /source
+   and /published.
+   Nothing in here does any locking; the caches use it with their own lock
+   held. */
+
+struct attr;
+struct dir;
+
+typedef struct name {
+  const char *name;	/* interned, shared with other nodes of that name */
+  struct name *parent;
+  struct name *children;
+  struct attr *attr;	/* attribute cache entry, if any */
+  struct dir *dir;	/* directory cache entry, if any */
+  unsigned long gen;	/* generation of the subtree, see cache_invalidate_tree() */
+  time_t gen_time;	/* time of the last invalidation */
+  uint64_t listing;	/* hash of the last listing, see learn_ttl() */
+  int ttl;		/* timeout learned for listings, 0 if none */
+  UT_hash_handle hh;	/* in the parent's children */
+} name_t;
+
+name_t *names_root(void);
+name_t *names_child(name_t *parent, const char *name, size_t len, int create);
+name_t *names_lookup(const char *path, int create);
+name_t *names_closest(const char *path);
+char *names_path(name_t *n);
+void names_release(name_t *n);
+void names_prune(name_t *n);
+void names_report(FILE *fp);
+void names_free(void);
@@ -18,7 +18,7 @@
  *
  */
 
-#define FUSE_USE_VERSION  26
+#define FUSE_USE_VERSION  28
 
 #define DEBUG_OBSFS
 
@@ -34,15 +34,35 @@
 #include <expat.h>
 #include <unistd.h>
 #include <regex.h>
+#include <stdint.h>
+#include <glib.h>
+#include <poll.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <utime.h>
 
 #include "obsfs.h"
 #include "cache.h"
 #include "util.h"
 #include "status.h"
 #include "rc.h"
+#include "http.h"
+#include "commit.h"
+#include "writeback.h"
+#include "memcache.h"
+#include "prjinfo.h"
+#include "buildinfo.h"
+#include "buildlog.h"
+#include "zcache.h"
+#include "prefetch.h"
+#include "triage.h"
+#include "srcstore.h"
+#include "changes.h"
+#include "buildwatch.h"
+#include "log.h"
 
 #ifdef DEBUG_OBSFS
-#define DEBUG(x...) fprintf(stderr, x)
+#define DEBUG(x...) LOG(LOG_FUSE, LEVEL_DEBUG, x)
 #else
 #define DEBUG(x...)
 #endif
@@ -53,12 +73,23 @@ const char *root_dir[] = {
   "/published",
   "/request",
   "/statistics",
+  NODE_CONTROL,
   NULL
 };
 
+/* status files in the control directory */
+const char *control_nodes[] = {
+  "writeback", "commit", "cache", "log", NULL
+};
+
+/* build summaries of a project, in the order of the SUMMARY_* formats */
+const char *summary_nodes[] = {
+  NODE_SUMMARY, NODE_SUMMARY ".tsv", NODE_SUMMARY ".json", NULL
+};
+
 /* package status APIs */
 const char const *status_api[] = {
-  "_history", "_reason", "_status", "_log", NULL
+  "_history", "_reason", "_status", "_log", NODE_LOG_TAIL, NULL
 };
 
 regex_t build_project;
@@ -68,6 +99,11 @@ regex_t build_project_failed_foo_bar;
 regex_t build_project_repo_arch;
 regex_t build_project_repo_arch_foo;
 regex_t build_project_repo_arch_failed;
+regex_t build_project_repo_arch_package;
+regex_t build_project_repo_arch_package_status;
+regex_t build_project_repo_arch_package_tail;
+regex_t build_project_summary;
+regex_t tree_dir;
 regex_t source_project;
 regex_t source_project_package;
 regex_t source_project_package_rev;
@@ -75,18 +111,53 @@ regex_t source_project_package_rev_num;
 regex_t source_project_package_unexpanded;
 regex_t source_myprojectpackages;
 
+char **prefetch_patterns = NULL;	/* parsed prefetch_files option */
+
 char *file_cache_dir = NULL;	/* directory to keep cached file contents in */
 int file_cache_count = 1;	/* used to make up names for cached files */
 
-char *url_prefix = NULL;	/* prefix for API calls (https://...) */
-
 /* filesystem options */
 struct options {
   char *api_username;	/* API user name */
   char *api_password;	/* API user password */
   char *api_hostname;	/* API server name */
+  unsigned int commit_delay;	/* seconds to wait before committing a package */
+  unsigned int writeback_threads;	/* number of upload workers */
+  unsigned int upload_rate;	/* upload bandwidth limit in KB/s */
+  unsigned int memcache_size;	/* in-memory file cache size in KB */
+  unsigned int memcache_file;	/* largest file kept in memory in KB */
+  int prefetch_info;	/* get source info for whole projects */
+  int bulk_build;	/* get build results and binaries for whole projects */
+  unsigned int log_tail;	/* size of _log.tail in KB */
+  int nocompress;	/* store cached text files uncompressed */
+  unsigned int prefetch_threads;	/* number of prefetch workers */
+  char *prefetch_files;	/* package files to prefetch, colon-separated patterns */
+  unsigned int prefetch_size;	/* largest file to prefetch in KB */
+  char *triage;		/* retrieve the logs in _failed directories: "log" or "tail" */
+  unsigned int triage_conns;	/* logs retrieved at the same time */
+  unsigned int triage_budget;	/* MB retrieved per _failed directory */
+  unsigned int changes;	/* change feed poll interval in seconds */
+  int build_watch;	/* wait for build results to change instead of polling */
+  unsigned int dir_ttl_min;	/* bounds of the directory cache timeouts */
+  unsigned int dir_ttl_max;
+  char *log;		/* log levels, see log_set() */
 } options;
 
+/* open file, kept in fuse_file_info->fh */
+typedef struct {
+  int fd;		/* descriptor of the local copy, -1 if it is in memory */
+  mem_t *mem;		/* in-memory copy */
+  zfile_t *z;		/* compressed cache file, NULL if fd is plain */
+  GChecksum *md5;	/* MD5 of the data written sequentially from the start
+                           of the file; NULL if the writes were not sequential */
+  off_t md5_len;	/* number of bytes covered by md5 */
+  unsigned long md5_gen;	/* write generation of the file after our last write */
+  log_t *log;		/* build log that may still grow */
+  off_t log_seen;	/* how far the reader has got in the log */
+} file_t;
+
+#define FILE_T(fi) ((file_t *)(uintptr_t)(fi)->fh)
+
 /* lifted from the Hello, World with options example */
 #define OBSFS_OPT_KEY(t, p, v) { t, offsetof(struct options, p), v }
 
@@ -100,6 +171,26 @@ static struct fuse_opt obsfs_opts[] =
   OBSFS_OPT_KEY("user=%s", api_username, 0),
   OBSFS_OPT_KEY("pass=%s", api_password, 0),
   OBSFS_OPT_KEY("host=%s", api_hostname, 0),
+  OBSFS_OPT_KEY("commit_delay=%u", commit_delay, 0),
+  OBSFS_OPT_KEY("writeback_threads=%u", writeback_threads, 0),
+  OBSFS_OPT_KEY("upload_rate=%u", upload_rate, 0),
+  OBSFS_OPT_KEY("memcache=%u", memcache_size, 0),
+  OBSFS_OPT_KEY("memcache_file=%u", memcache_file, 0),
+  OBSFS_OPT_KEY("prefetch_info", prefetch_info, 1),
+  OBSFS_OPT_KEY("bulk_build", bulk_build, 1),
+  OBSFS_OPT_KEY("log_tail=%u", log_tail, 0),
+  OBSFS_OPT_KEY("nocompress", nocompress, 1),
+  OBSFS_OPT_KEY("prefetch_threads=%u", prefetch_threads, 0),
+  OBSFS_OPT_KEY("prefetch_files=%s", prefetch_files, 0),
+  OBSFS_OPT_KEY("prefetch_size=%u", prefetch_size, 0),
+  OBSFS_OPT_KEY("triage=%s", triage, 0),
+  OBSFS_OPT_KEY("triage_conns=%u", triage_conns, 0),
+  OBSFS_OPT_KEY("triage_budget=%u", triage_budget, 0),
+  OBSFS_OPT_KEY("changes=%u", changes, 0),
+  OBSFS_OPT_KEY("build_watch", build_watch, 1),
+  OBSFS_OPT_KEY("dir_ttl_min=%u", dir_ttl_min, 0),
+  OBSFS_OPT_KEY("dir_ttl_max=%u", dir_ttl_max, 0),
+  OBSFS_OPT_KEY("log=%s", log, 0),
   FUSE_OPT_KEY("-h",		KEY_HELP),
   FUSE_OPT_KEY("--help",	KEY_HELP),
   FUSE_OPT_KEY("-V",		KEY_VERSION),
@@ -109,6 +200,8 @@ static struct fuse_opt obsfs_opts[] =
 
 static int obsfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
                          off_t offset, struct fuse_file_info *fi);
+static int get_api_dir(const char *path, void *buf, fuse_fill_dir_t filler);
+static void prefetch_file(const char *path);
                          
 static int is_in_root_dir(const char *path)
 {
@@ -120,6 +213,140 @@ static int is_in_root_dir(const char *path)
   return 0;
 }
 
+/* In an expanded source directory, all files are retrieved with a
+   "rev=..." parameter (the revision is stored in the dir cache entry and
+   is added by make_url()); this is no good for the status APIs,
+   particularly _history, which would only display one revision then. We
+   therefore have to make an exception for these nodes and not specify a
+   revision when retrieving them. */
+static const char *file_rev(const char *effective_path, attr_t *at)
+{
+  const char **s;
+  if (!at)
+    return NULL;
+  for (s = status_api; *s; s++) {
+    if (strstr(effective_path, *s))
+      return NULL;
+  }
+  return at->rev;
+}
+
+/* Many nodes are aliases of other files (_failed logs, _rev and
+   _unexpanded sources, _activity and _rating), and they share the cache
+   entry of the file they point to, so that reading a file through several
+   of them costs only one download.  Such entries are keyed by the API path
+   and revision they are retrieved from.  Everything else, and aliases that
+   have been written to, is cached under its own path, which is where
+   writeback and commits look for it.  Returns the key, which is either
+   "path" itself or put together in "buf". */
+static const char *cache_key(const char *path, attr_t *at, char *buf, size_t size)
+{
+  struct stat st;
+  const char *rev;
+  int len;
+  if (!at || !at->hardlink || !lstat(path + 1, &st))
+    return path;
+  rev = file_rev(at->hardlink, at);
+  len = snprintf(buf, size, "%s%s%s", at->hardlink, rev ? "@" : "", rev ? : "");
+  /* a key too long for us gets a copy of its own */
+  return len < 0 || (size_t)len >= size ? path : buf;
+}
+
+/* size of the local copy of the cache entry "key", if there is one */
+static int cached_size(const char *key, off_t *size)
+{
+  struct stat st;
+  /* small file held in memory, or compressed cache file */
+  if (!memcache_size(key, size) || !zcache_size(key, size))
+    return 0;
+  if (lstat(key + 1 /* skip leading slash */, &st))
+    return -1;
+  *size = st.st_size;
+  return 0;
+}
+
+/* Opening a file fills in its cache entry if necessary; opens of the same
+   entry, possibly through different aliases, wait for each other so that
+   it is not retrieved twice at the same time. */
+typedef struct {
+  char *key;
+  UT_hash_handle hh;
+} filling_t;
+
+static filling_t *filling_hash = NULL;
+static pthread_mutex_t filling_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t filling_cond = PTHREAD_COND_INITIALIZER;
+
+static void fill_lock(const char *key)
+{
+  filling_t *e;
+  pthread_mutex_lock(&filling_mutex);
+  for (;;) {
+    HASH_FIND_STR(filling_hash, key, e);
+    if (!e)
+      break;
+    pthread_cond_wait(&filling_cond, &filling_mutex);
+  }
+  e = calloc(1, sizeof(filling_t));
+  e->key = strdup(key);
+  HASH_ADD_KEYPTR(hh, filling_hash, e->key, strlen(e->key), e);
+  pthread_mutex_unlock(&filling_mutex);
+}
+
+static void fill_unlock(const char *key)
+{
+  filling_t *e;
+  pthread_mutex_lock(&filling_mutex);
+  HASH_FIND_STR(filling_hash, key, e);
+  if (e) {
+    HASH_DEL(filling_hash, e);
+    free(e->key);
+    free(e);
+  }
+  pthread_cond_broadcast(&filling_cond);
+  pthread_mutex_unlock(&filling_mutex);
+}
+
+/* The change feed tells us that a cached file is out of date.  It may be
+   open, so instead of removing it, we make it look old enough to be
+   retrieved again the next time it is opened. */
+static void drop_file(const char *path)
+{
+  struct utimbuf ut = { 0, 0 };
+  memcache_remove(path);
+  utime(path + 1 /* skip leading slash */, &ut);
+}
+
+/* prefetch job for directories */
+static void prefetch_dir(const char *path)
+{
+  get_api_dir(path, NULL, NULL);
+}
+
+/* The kernel looks up a path one component at a time, and every cache miss
+   costs us a directory listing.  The upper levels of the /build and /source
+   trees are always directories, so when we miss a path there, we get the
+   listing of the path itself (likely to be looked into next) and those of
+   any of its ancestors we don't have in the background, while the caller
+   retrieves the parent directory. */
+static void prefetch_tree(const char *path)
+{
+  char p[PATH_MAX], parent[PATH_MAX];
+  char *slash;
+  if (!view_cpy(p, sizeof(p), (strview_t){ path, strlen(path) }) ||
+      dirname_buf(path, parent, sizeof(parent), NULL))
+    return;
+  for (;;) {
+    /* the parent is retrieved by the caller */
+    if (strcmp(p, parent) && !regexec(&tree_dir, p, 0, NULL, 0) && !dir_cache_fresh(p))
+      prefetch_queue(p, prefetch_dir, PREFETCH_HIGH);
+    slash = strrchr(p, '/');
+    if (!slash || slash == p)
+      break;
+    *slash = 0;
+  }
+}
+
 static int obsfs_getattr(const char *path, struct stat *stbuf)
 {
   /* initialize the stat buffer we are going to fill in */
@@ -134,11 +361,28 @@ static int obsfs_getattr(const char *path, struct stat *stbuf)
     /* actual API files and directories */
     attr_t *ret;
     DEBUG("getattr: looking for %s\n", path);
+    /* build logs that are being read may have grown */
+    ret = attr_cache_find(path);
+    if (ret && ret->hardlink) {
+      /* ...including when they are read through an alias */
+      char keybuf[API_PATH_MAX];
+      const char *key = cache_key(path, ret, keybuf, sizeof(keybuf));
+      off_t size;
+      buildlog_refresh_path(key);
+      if (!cached_size(key, &size))
+        attr_cache_set_size(path, size);
+    }
+    else
+      buildlog_refresh_path(path);
+    attr_cache_put(ret);
     /* let's see if we have that cached already */
     ret = attr_cache_find(path);
     if (ret) {
       DEBUG("found it!\n");
+      cache_lock();
       *stbuf = ret->st;
+      cache_unlock();
+      attr_cache_put(ret);
     } 
     else {
       /* Cache miss, we are going to retrieve the directory "path" is in.
@@ -148,16 +392,19 @@ static int obsfs_getattr(const char *path, struct stat *stbuf)
          without giving it a filler function, so it will only cache
          the entries it finds in the attribute cache, where we can
          subsequently retrieve the one we're looking for. */
-      char *dir = dirname_c(path, NULL);
+      char dir[PATH_MAX];
+      if (dirname_buf(path, dir, sizeof(dir), NULL))
+        return -ENAMETOOLONG;
       DEBUG("not found, trying to get directory\n");
+      prefetch_tree(path);
       /* call with buf and filler NULL for cache-only operation */
       obsfs_readdir(dir, NULL, NULL, 0, NULL);
-      free(dir);
       /* now the attributes are in the attr cache (if it exists at all) */
       ret = attr_cache_find(path);
       if (ret) {
         DEBUG("found it after all\n");
         *stbuf = ret->st;
+        attr_cache_put(ret);
       }
       else {
         /* file not found */
@@ -174,17 +421,21 @@ static int obsfs_readlink(const char *path, char *buf, size_t buflen)
   attr_t *ret = attr_cache_find(path);
   if (ret) {
 found:
-    if (!ret->symlink)
+    if (!ret->symlink) {
+      attr_cache_put(ret);
       return -ENOENT;
+    }
     strncpy(buf, ret->symlink, buflen - 1);
     buf[buflen-1] = 0;
+    attr_cache_put(ret);
     return 0;
   }
-  char *dir = dirname_c(path, NULL);
+  char dir[PATH_MAX];
+  if (dirname_buf(path, dir, sizeof(dir), NULL))
+    return -ENAMETOOLONG;
   DEBUG("link not found, trying to get directory\n");
   /* call with buf and filler NULL for cache-only operation */
   obsfs_readdir(dir, NULL, NULL, 0, NULL);
-  free(dir);
   /* now the attributes are in the attr cache (if it exists at all) */
   ret = attr_cache_find(path);
   if (ret)
@@ -206,20 +457,20 @@ struct filbuf {
   int in_revisionlist;		/* flag set when inside a <revisionlist> */
   const char *filter_attr;
   const char *filter_value;
+  const char *rev;		/* revision to use instead of the one in the listing */
+  FILE *raw;			/* copy of the listing as retrieved, if wanted */
 };
 
-/* add a node to a FUSE directory buffer, a directory cache entry, and the attribute cache */
-static void add_dir_node(void *buf, fuse_fill_dir_t filler, dir_t *newdir, const char *path, const char *node_name, struct stat *st, const char *symlink, const char *hardlink)
+/* add a node to a FUSE directory buffer, a directory cache entry, and the
+   attribute cache, along with the MD5 sum of its contents if we know it */
+static void add_dir_node_md5(void *buf, fuse_fill_dir_t filler, dir_t *newdir, const char *path, const char *node_name, struct stat *st, const char *symlink, const char *hardlink, const char *md5)
 {
-  char *full_path;
+  char full_path[PATH_MAX], keybuf[API_PATH_MAX];
+  attr_t *at;
   /* add node to the directory buffer (if any) */
   if (filler)
     filler(buf, node_name, st, 0);
 
-  /* compose a full path and add node to the attribute cache */
-  full_path = malloc(strlen(path) + 1 /* slash */ + strlen(node_name) + 1 /* null */);
-  sprintf(full_path, "%s/%s", path, node_name);
-
   /* Tricky problem: Apparently, FUSE does a LOOKUP (using the getattr
      method) before every open(), but it only does a GETATTR (also using the
      getattr method) the first time a file is opened.  That means that our
@@ -236,13 +487,14 @@ static void add_dir_node(void *buf, fuse_fill_dir_t filler, dir_t *newdir, const
      To work around this problem, we simply check if we have a cached copy
      already and use its size if so. */
 
-  /* check if we have a local copy that we can use to get the size */
-  struct stat local_st;
-  if (!lstat(full_path + 1 /* skip leading slash */, &local_st)) {
-    st->st_size = local_st.st_size;
-  }
-
-  attr_cache_add(full_path, st, symlink, hardlink, newdir->rev);
+  /* add node to the attribute cache, and check if we have a local copy
+     that we can use to get the size */
+  at = attr_cache_add_child(newdir, node_name, st, symlink, hardlink, newdir->rev);
+  if (!path_join(full_path, sizeof(full_path), path, node_name))
+    cached_size(cache_key(full_path, at, keybuf, sizeof(keybuf)), &at->st.st_size);
+  if (md5)
+    attr_cache_set_md5(at, md5);
+  attr_cache_put(at);
   
   /* add node to the directory cache entry */
   dir_cache_add(newdir, node_name, S_ISDIR(st->st_mode) ? 1 : 0);
@@ -251,9 +503,13 @@ static void add_dir_node(void *buf, fuse_fill_dir_t filler, dir_t *newdir, const
     attr_t *parent = attr_cache_find(path);
     if (parent)
       parent->st.st_nlink++;
+    attr_cache_put(parent);
   }
-  
-  free(full_path);
+}
+
+static void add_dir_node(void *buf, fuse_fill_dir_t filler, dir_t *newdir, const char *path, const char *node_name, struct stat *st, const char *symlink, const char *hardlink)
+{
+  add_dir_node_md5(buf, filler, newdir, path, node_name, st, symlink, hardlink, NULL);
 }
 
 /* expat tag start callback for reading API directories */
@@ -281,9 +537,13 @@ static void expat_api_dir_start(void *ud, const XML_Char *name, const XML_Char *
       if (!strcmp(atts[0], "rev")) {
         /* when working on expanded sources, we need to specify the revision when GETting
            files, so we remember it here */
-        fb->cdir->rev = strdup(atts[1]);
+        fb->cdir->rev = strdup(fb->rev ? : atts[1]);
         DEBUG("source dir rev %s\n", fb->cdir->rev);
       }
+      else if (!strcmp(atts[0], "srcmd5") && !fb->cdir->srcmd5) {
+        /* identifies the sources, used to revalidate the listing */
+        fb->cdir->srcmd5 = strdup(atts[1]);
+      }
       atts += 2;
     }
     return;
@@ -301,6 +561,7 @@ static void expat_api_dir_start(void *ud, const XML_Char *name, const XML_Char *
     char *symlink = NULL;
     char *hardlink = NULL;
     char *relink = NULL;
+    const char *md5 = NULL;
     
     stat_make_dir(&st);	/* assume it's a directory until we know better */
     /* process all attributes */
@@ -354,10 +615,9 @@ static void expat_api_dir_start(void *ud, const XML_Char *name, const XML_Char *
                saved the revision number already, so all we have to do here is
                to hardlink to the regular source file; "&rev=..." will be added
                automatically */
-            char *package_path = get_match(matches[1], fb->fs_path);
-            hardlink = malloc(strlen(package_path) + 1 + strlen(filename) + 1);
-            sprintf(hardlink, "%s/%s", package_path, filename);
-            free(package_path);
+            strview_t package_path = match_view(matches[1], fb->fs_path);
+            hardlink = malloc(package_path.len + 1 + strlen(filename) + 1);
+            sprintf(hardlink, "%.*s/%s", VIEW_ARGS(package_path), filename);
             st.st_mode &= ~S_IWUSR;	/* FIXME: overwritten by stat_make_*() */
           }
           /* Muddy waters:
@@ -382,6 +642,10 @@ static void expat_api_dir_start(void *ud, const XML_Char *name, const XML_Char *
       else if (!strcmp(atts[0], "mtime")) {
         st.st_mtime = atoi(atts[1]);
       }
+      else if (!strcmp(atts[0], "md5")) {
+        /* source files; used to tell if a modified file really needs uploading */
+        md5 = atts[1];
+      }
       else if (!strcmp(atts[0], "project")) {
         if (fb->in_latest) {
           relink = malloc(strlen("../../source/") + strlen(atts[1]) + strlen("/%s") + 1);
@@ -396,8 +660,10 @@ static void expat_api_dir_start(void *ud, const XML_Char *name, const XML_Char *
           /* Only add this project if it isn't already there.
              (We are processing a list of packages here, several of which can come from
              the same project.) */
-          if (!attr_cache_find(full_path))
+          attr_t *at = attr_cache_find(full_path);
+          if (!at)
             filename = atts[1];
+          attr_cache_put(at);
           free(full_path);
         }
       }
@@ -413,7 +679,7 @@ static void expat_api_dir_start(void *ud, const XML_Char *name, const XML_Char *
         free(relink);
       }
       
-      add_dir_node(fb->buf, fb->filler, fb->cdir, fb->fs_path, filename, &st, symlink, hardlink);
+      add_dir_node_md5(fb->buf, fb->filler, fb->cdir, fb->fs_path, filename, &st, symlink, hardlink, md5);
 
       if (symlink)
         free(symlink);
@@ -454,6 +720,13 @@ static void expat_api_dir_start(void *ud, const XML_Char *name, const XML_Char *
       strcat(hardlink, "/_log");
       
       add_dir_node(fb->buf, fb->filler, fb->cdir, fb->fs_path, packagename, &st, NULL, hardlink);
+      
+      /* ...and to the end of it */
+      char *tail = malloc(strlen(packagename) + strlen(".tail") + 1);
+      sprintf(tail, "%s.tail", packagename);
+      strcat(hardlink, ".tail");
+      add_dir_node(fb->buf, fb->filler, fb->cdir, fb->fs_path, tail, &st, NULL, hardlink);
+      free(tail);
 
       free(hardlink);
     }
@@ -483,37 +756,24 @@ static void expat_api_dir_end(void *ud, const XML_Char *name)
   }
 }
 
-/* expat expects an fwrite()-style callback, so we need an adapter for XML_Parse() */
+/* expat expects an fwrite()-style callback, so we need an adapter for
+   XML_Parse(); it also keeps a copy of the listing if asked to */
 static size_t write_adapter(void *ptr, size_t size, size_t nmemb, void *userdata)
 {
-  XML_Parse((XML_Parser)userdata, ptr, size * nmemb, 0);
+  XML_Parser xp = (XML_Parser)userdata;
+  struct filbuf *fb = (struct filbuf *)XML_GetUserData(xp);
+  if (fb->raw)
+    fwrite(ptr, size, nmemb, fb->raw);
+  XML_Parse(xp, ptr, size * nmemb, 0);
   return size * nmemb;
 }
 
-/* initialize curl and set API user name and password, writer function and user data */
-static CURL *curl_open_file(const char *url, void *read_fun, void *read_data, void *write_fun, void *write_data)
+/* create an expat parser that reads the directory "fs_path" into "fb" */
+static XML_Parser dir_parser(struct filbuf *fb, void *buf, fuse_fill_dir_t filler, dir_t *newdir,
+                             const char *fs_path, const char *api_path, const char *mangled_path,
+                             const char *filter_attr, const char *filter_value)
 {
-  CURL *curl = curl_easy_init();
-  curl_easy_setopt(curl, CURLOPT_URL, url);
-  curl_easy_setopt(curl, CURLOPT_USERNAME, options.api_username);
-  curl_easy_setopt(curl, CURLOPT_PASSWORD, options.api_password);
-  curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_fun);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_fun);
-  curl_easy_setopt(curl, CURLOPT_READDATA, read_data);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, write_data);
-  curl_easy_setopt(curl, CURLOPT_COOKIEFILE, "cookies"); /* start cookie engine */
-  curl_easy_setopt(curl, CURLOPT_COOKIEJAR, "cookies");
-  return curl;
-}
-
-static void parse_dir(void *buf, fuse_fill_dir_t filler, dir_t *newdir, const char *fs_path, const char *api_path,
-                      const char *mangled_path, const char *filter_attr, const char *filter_value)
-{
-  char *urlbuf;	/* used to compose the full API URL */
-  CURL *curl;
-  CURLcode ret;
   XML_Parser xp;
-  struct filbuf fb;	/* data the expat callbacks need */
   
   DEBUG("parsing directory %s (API %s)\n", fs_path, api_path);
   
@@ -522,19 +782,28 @@ static void parse_dir(void *buf, fuse_fill_dir_t filler, dir_t *newdir, const ch
     abort();
 
   /* copy some data that the parser callbacks will need */
-  memset(&fb, 0, sizeof(fb));
-  fb.filler = filler;
-  fb.buf = buf;
-  fb.fs_path = fs_path;
-  fb.api_path = api_path;
-  fb.mangled_path = mangled_path;
-  fb.cdir = newdir;
-  fb.filter_attr = filter_attr;
-  fb.filter_value = filter_value;
-  XML_SetUserData(xp, (void *)&fb);	/* pass the data to the parser */
+  memset(fb, 0, sizeof(*fb));
+  fb->filler = filler;
+  fb->buf = buf;
+  fb->fs_path = fs_path;
+  fb->api_path = api_path;
+  fb->mangled_path = mangled_path;
+  fb->cdir = newdir;
+  fb->filter_attr = filter_attr;
+  fb->filter_value = filter_value;
+  XML_SetUserData(xp, (void *)fb);	/* pass the data to the parser */
 
   /* set handlers for start and end tags */
   XML_SetElementHandler(xp, expat_api_dir_start, expat_api_dir_end);
+  return xp;
+}
+
+/* retrieve the API directory "api_path" and feed it to the parser "xp" */
+static CURLcode fetch_dir(XML_Parser xp, const char *api_path)
+{
+  char *urlbuf;	/* used to compose the full API URL */
+  CURL *curl;
+  CURLcode ret;
   
   /* construct the full API URL for this directory */
   urlbuf = make_url(url_prefix, api_path, NULL);
@@ -547,31 +816,207 @@ static void parse_dir(void *buf, fuse_fill_dir_t filler, dir_t *newdir, const ch
      the API server and call the write_adapter() for each hunk of data, which will
      in turn call XML_Parse() which will funnel the invidiual components through
      the start and end tag handlers expat_api_dir_start() and expat_api_dir_end() */
-  if ((ret = curl_easy_perform(curl))) {
-    fprintf(stderr,"curl error %d\n", ret);
+  if ((ret = http_perform(curl))) {
+    LOG(LOG_HTTP, LEVEL_ERROR, "curl error %d\n", ret);
   }
   
   /* clean up stuff */
-  curl_easy_cleanup(curl);
-  XML_ParserFree(xp);
+  http_close(curl);
   free(urlbuf);
+  return ret;
+}
+
+static void parse_dir(void *buf, fuse_fill_dir_t filler, dir_t *newdir, const char *fs_path, const char *api_path,
+                      const char *mangled_path, const char *filter_attr, const char *filter_value)
+{
+  struct filbuf fb;	/* data the expat callbacks need */
+  XML_Parser xp = dir_parser(&fb, buf, filler, newdir, fs_path, api_path, mangled_path, filter_attr, filter_value);
+  fetch_dir(xp, api_path);
+  XML_ParserFree(xp);
+}
+
+/* Expanded source listings are fully determined by their srcmd5, so we
+   keep them in the listing store.  If we know the srcmd5 of the listing
+   beforehand, we take it from there instead of asking the server. */
+static void parse_source_dir(void *buf, fuse_fill_dir_t filler, dir_t *newdir, const char *fs_path,
+                             const char *api_path, const char *mangled_path, const char *srcmd5)
+{
+  struct filbuf fb;
+  XML_Parser xp = dir_parser(&fb, buf, filler, newdir, fs_path, api_path, mangled_path, NULL, NULL);
+  char *data;
+  size_t len;
+  
+  if (srcmd5 && !srcstore_get(srcmd5, &data, &len)) {
+    /* the listing may have come from another package or revision with the
+       same sources, so its revision number may not be ours, but the srcmd5
+       identifies the sources just as well */
+    fb.rev = srcmd5;
+    XML_Parse(xp, data, len, 1);
+  }
+  else {
+    fb.raw = open_memstream(&data, &len);
+    CURLcode ret = fetch_dir(xp, api_path);
+    fclose(fb.raw);
+    if (!ret && newdir->srcmd5)
+      srcstore_put(newdir->srcmd5, data, len);
+  }
+  free(data);
+  XML_ParserFree(xp);
 }
 
-/* string appendectomy: remove "appendix" by copying the non-"appendix"
-   parts of "patient" to a new string and returning it */
-static char *strstripcpy(char *patient, const char *appendix)
+/* string appendectomy: remove "appendix" from "patient" by moving the
+   rest of it up; returns -1 if there is no "appendix" */
+static int strstrip(char *patient, const char *appendix)
 {
-  char *ret;
   char *apploc = strstr(patient, appendix);
+  size_t len = strlen(appendix);
   if (!apploc)
-    return NULL;				/* nothing found */
-  ret = malloc(strlen(patient) + 1);		/* the new string is not likely to be larger than the old one */
-  strncpy(ret, patient, apploc - patient);	/* copy everything up to "appendix" */
-  ret[apploc - patient] = 0;			/* terminate string (in case the following strcat() is a NOP */
-  strcat(ret + (apploc - patient), apploc + strlen(appendix));	/* copy stuff after "appendix" */
+    return -1;				/* nothing found */
+  memmove(apploc, apploc + len, strlen(apploc + len) + 1);	/* including the terminating null */
+  return 0;
+}
+
+/* filling /build directories from the build snapshot */
+struct build_fill {
+  void *buf;
+  fuse_fill_dir_t filler;
+  dir_t *newdir;
+  const char *path;
+};
+
+/* add the binaries of a package to its directory; "bb" is NULL if we don't
+   know them */
+static void build_fill_binaries(void *buf, fuse_fill_dir_t filler, dir_t *newdir, const char *path, bbin_t *bb)
+{
+  struct stat st;
+  int i;
+  if (!bb)
+    return;
+  stat_default_file(&st);
+  for (i = 0; i < bb->num_binaries; i++) {
+    st.st_size = bb->binaries[i].size;
+    add_dir_node(buf, filler, newdir, path, bb->binaries[i].name, &st, NULL, NULL);
+  }
+}
+
+/* buildinfo_foreach() callback for /build/<project>/<repo>/<arch>/<package> */
+static void build_fill_package(barch_t *ba, bpkg_t *bp, bbin_t *bb, void *userdata)
+{
+  struct build_fill *bf = (struct build_fill *)userdata;
+  build_fill_binaries(bf->buf, bf->filler, bf->newdir, bf->path, bb);
+}
+
+/* buildinfo_foreach() callback for /build/<project>/<repo>/<arch>; the
+   package directories are cached right away, too */
+static void build_fill_arch(barch_t *ba, bpkg_t *bp, bbin_t *bb, void *userdata)
+{
+  struct build_fill *bf = (struct build_fill *)userdata;
+  struct stat st;
+  int i;
+  
+  stat_default_dir(&st);
+  add_dir_node(bf->buf, bf->filler, bf->newdir, bf->path, bp->package, &st, NULL, NULL);
+  
+  char pkg_path[PATH_MAX];
+  if (path_join(pkg_path, sizeof(pkg_path), bf->path, bp->package))
+    return;
+  dir_t *pkgdir = dir_cache_new(pkg_path);
+  build_fill_binaries(NULL, NULL, pkgdir, pkg_path, bb);
+  stat_default_file(&st);
+  for (i = 0; status_api[i]; i++)
+    add_dir_node(NULL, NULL, pkgdir, pkg_path, status_api[i], &st, NULL, NULL);
+  dir_cache_put(pkgdir);
+}
+
+/* fill in a repository or package directory in /build from the project's
+   build snapshot; returns -1 if the snapshot can't be had */
+static int get_build_dir(const char *path, const char *canon_path, void *buf, fuse_fill_dir_t filler, dir_t *newdir)
+{
+  regmatch_t matches[10];
+  struct build_fill bf;
+  int ret = -1;
+  
+  if (regexec(&build_project_repo_arch_package, canon_path, 10, matches, 0))
+    return -1;
+  char project[NAME_MAX + 1], repo[NAME_MAX + 1], arch[NAME_MAX + 1], pkgbuf[NAME_MAX + 1];
+  char *package = NULL;
+  if (!view_cpy(project, sizeof(project), match_view(matches[1], canon_path)) ||
+      !view_cpy(repo, sizeof(repo), match_view(matches[2], canon_path)) ||
+      !view_cpy(arch, sizeof(arch), match_view(matches[3], canon_path)))
+    return -1;
+  if (matches[5].rm_so != -1 && !(package = view_cpy(pkgbuf, sizeof(pkgbuf), match_view(matches[5], canon_path))))
+    return -1;
+  
+  bf.buf = buf;
+  bf.filler = filler;
+  bf.newdir = newdir;
+  bf.path = path;
+  if (!buildinfo_result(project) && !buildinfo_binaries(project, repo, arch)) {
+    if (package)
+      ret = buildinfo_foreach(project, repo, arch, package, build_fill_package, &bf) > 0 ? 0 : -1;
+    else
+      ret = buildinfo_foreach(project, repo, arch, NULL, build_fill_arch, &bf) >= 0 ? 0 : -1;
+  }
   return ret;
 }
 
+/* Somebody looking at a package is likely to read its spec file and
+   metadata next, so we get small files matching the prefetch patterns into
+   the cache right away. */
+static void prefetch_package_files(const char *path, dir_t *dir)
+{
+  int i;
+  char **pat;
+  cache_lock();
+  for (i = 0; i < dir->num_entries; i++) {
+    const char *name = dir->entries[i].name;
+    if (dir->entries[i].is_dir)
+      continue;
+    for (pat = prefetch_patterns; *pat; pat++) {
+      if (!fnmatch(*pat, name, 0))
+        break;
+    }
+    if (!*pat)
+      continue;
+    char full_path[PATH_MAX];
+    if (path_join(full_path, sizeof(full_path), path, name))
+      continue;
+    attr_t *at = attr_cache_find(full_path);
+    if (at && at->st.st_size <= (off_t)options.prefetch_size * 1024)
+      prefetch_queue(full_path, prefetch_file, PREFETCH_LOW);
+    attr_cache_put(at);
+  }
+  cache_unlock();
+}
+
+/* queue the logs (or their tails) in the _failed directory "path" for
+   retrieval in the background */
+static void triage_failed(const char *path, dir_t *dir)
+{
+  int i, num = 0;
+  int tails = !strcmp(options.triage, "tail");
+  size_t len = 0, off = 0;
+  char **paths, *buf;
+  cache_lock();
+  /* all the paths go into one buffer */
+  for (i = 0; i < dir->num_entries; i++)
+    len += strlen(path) + 1 + strlen(dir->entries[i].name) + 1;
+  paths = calloc(dir->num_entries, sizeof(char *));
+  buf = malloc(len ? : 1);
+  for (i = 0; i < dir->num_entries; i++) {
+    const char *name = dir->entries[i].name;
+    if (dir->entries[i].is_dir || endswith(name, ".tail") != tails)
+      continue;
+    paths[num] = buf + off;
+    off += sprintf(paths[num], "%s/%s", path, name) + 1;
+    num++;
+  }
+  cache_unlock();
+  triage_start(paths, num);
+  free(buf);
+  free(paths);
+}
+
 /* read an API directory and fill in the FUSE directory buffer, the directory
    cache, and the attribute cache */
 static int get_api_dir(const char *path, void *buf, fuse_fill_dir_t filler)
@@ -586,21 +1031,39 @@ static int get_api_dir(const char *path, void *buf, fuse_fill_dir_t filler)
     filler(buf, "..", NULL, 0);
   }
   
+  /* keep an eye on the build results of projects we are looking at */
+  if (options.build_watch)
+    buildwatch_touch(path);
+  
+  /* An expired package listing may well still be current; the project's
+     source info can tell us that for all its packages at once. */
+  if (options.prefetch_info && dir_cache_stale(path) &&
+      !regexec(&source_project_package, path, 3, matches, 0)) {
+    char srcmd5[MD5_HEX_LEN + 1], project[NAME_MAX + 1], package[NAME_MAX + 1];
+    if (view_cpy(project, sizeof(project), match_view(matches[1], path)) &&
+        view_cpy(package, sizeof(package), match_view(matches[2], path)) &&
+        !prjinfo_srcmd5(project, package, srcmd5))
+      dir_cache_revalidate(path, srcmd5);
+  }
+  
   /* see if we have this directory cached already */
   dir_t *dir = dir_cache_find(path);
   if (dir) {
-    cached_dirents = dir->entries;
-    cached_dirents_size = dir->num_entries;
     /* cache hit */
     int i;
     struct stat st;
 
     /* since this dir is already cached, we are done if we don't have a filler */
-    if (!filler)
+    if (!filler) {
+      dir_cache_put(dir);
       return 0;
+    }
 
     /* fill the FUSE dir buffer with our cached entries */
     stat_default_file(&st);
+    cache_lock();
+    cached_dirents = dir->entries;
+    cached_dirents_size = dir->num_entries;
     for (i = 0; i < cached_dirents_size; i++) {
       if (cached_dirents[i].is_dir)
         stat_make_dir(&st);
@@ -608,24 +1071,25 @@ static int get_api_dir(const char *path, void *buf, fuse_fill_dir_t filler)
         stat_make_file(&st);
       filler(buf, cached_dirents[i].name, &st, 0);
     }
+    cache_unlock();
+    dir_cache_put(dir);
   }
   else {
     /* not in cache, we have to retrieve it from the API server */
+    char canon_path[PATH_MAX];
+    if (strlen(path) >= sizeof(canon_path))
+      return -ENAMETOOLONG;
+    strcpy(canon_path, path);
     dir_t *newdir = dir_cache_new(path); /* get directory cache handle */
-
-    char *canon_path = strdup(path);
-    char *fpath;
     
     /* handle the build/<project>/_failed/... tree
        This tree collects all the fail logs to make it easier to get
        an overview of failing packages using, for instance, find. */
-    if ((fpath = strstr(canon_path, "/" NODE_FAILED))) {
-      char *opath = canon_path;		/* original path requested */
+    if (strstr(canon_path, "/" NODE_FAILED)) {
       if (!regexec(&build_project_failed_foo_bar, canon_path, 0, matches, 0)) {
         /* build/<project>/_failed/<foo>/<bar> is equivalent to
            build/<project>/<foo>/<bar>/_failed */
-        canon_path = strstripcpy(opath, "/" NODE_FAILED);	/* remove "/_failed" */
-        free(opath);
+        strstrip(canon_path, "/" NODE_FAILED);	/* remove "/_failed" */
         strcat(canon_path, "/" NODE_FAILED);		/* ...and add it again at the end */
         mangled_path = 1;
       }
@@ -633,8 +1097,7 @@ static int get_api_dir(const char *path, void *buf, fuse_fill_dir_t filler)
           !regexec(&build_project_failed, canon_path, 5, matches, 0)) {
         /* build/<project>/_failed and build/<project>/_failed/<foo> are
            equivalent to build/<project> and build/<project>/<foo>, respectively */
-        canon_path = strstripcpy(opath, "/" NODE_FAILED);	/* remove the "/_failed" */
-        free(opath);
+        strstrip(canon_path, "/" NODE_FAILED);	/* remove the "/_failed" */
         mangled_path = 1;	/* remember that we messed with the path so we don't add
                                    another "_failed" entry to this directory */
       }
@@ -646,56 +1109,55 @@ static int get_api_dir(const char *path, void *buf, fuse_fill_dir_t filler)
       for (i = 0; matches[i].rm_so != -1; i++) {
         DEBUG("REGEX match %d to %d\n", matches[i].rm_so, matches[i].rm_eo);
       }
-      char *project = get_match(matches[1], canon_path);
-      char *repo = get_match(matches[2], canon_path);
-      char *arch = get_match(matches[3], canon_path);
-      DEBUG("REGEX project %s repo %s arch %s\n", project, repo, arch);
+      strview_t project = match_view(matches[1], canon_path);
+      strview_t repo = match_view(matches[2], canon_path);
+      strview_t arch = match_view(matches[3], canon_path);
+      DEBUG("REGEX project %.*s repo %.*s arch %.*s\n", VIEW_ARGS(project), VIEW_ARGS(repo), VIEW_ARGS(arch));
 
       /* construct the API server path for "failed" results */
-      char *respath = malloc(strlen(project) + strlen(repo) + strlen(arch) + 100 /* too lazy to count right now */);
-      sprintf(respath, "/build/%s/_result?repository=%s&arch=%s", project, repo, arch);
+      char respath[API_PATH_MAX];
+      snprintf(respath, sizeof(respath), "/build/%.*s/_result?repository=%.*s&arch=%.*s",
+               VIEW_ARGS(project), VIEW_ARGS(repo), VIEW_ARGS(arch));
       
       /* parse only those entries that have attribute "code" with value "failed" */
       parse_dir(buf, filler, newdir, path, respath, canon_path, "code", "failed");
-      free(respath);
-      free(project);
-      free(repo);
-      free(arch);
+      if (options.triage)
+        triage_failed(path, newdir);
     }
     /* Or is it "/source/_my_{project,package}s"? */
     else if (!regexec(&source_myprojectpackages, canon_path, 10, matches, 0)) {
-      char *projectpackage = get_match(matches[1], canon_path); /* "project" or "package" */
-      char *project = get_match(matches[2], canon_path);	/* project name */
-      DEBUG("REGEX projectpackage %s project %s\n", projectpackage, project);
-      const char *my_p_path_format;
-      char *my_p_path;
-      if (!strcmp(projectpackage, "project") || strlen(project) == 0) {
+      strview_t projectpackage = match_view(matches[1], canon_path); /* "project" or "package" */
+      strview_t project = match_view(matches[2], canon_path);	/* project name */
+      DEBUG("REGEX projectpackage %.*s project %.*s\n", VIEW_ARGS(projectpackage), VIEW_ARGS(project));
+      char my_p_path[API_PATH_MAX];
+      if (!strncmp(projectpackage.ptr, "project", projectpackage.len) || project.len == 0) {
         /* /source/_my_projects or /source/_my_packages */
-        my_p_path_format = "/search/%s_id?match=person/@userid+=+'%s'";
-        my_p_path = malloc(strlen(my_p_path_format) + strlen(options.api_username) + strlen(projectpackage));
-        sprintf(my_p_path, my_p_path_format, projectpackage, options.api_username);
+        snprintf(my_p_path, sizeof(my_p_path), "/search/%.*s_id?match=person/@userid+=+'%s'",
+                 VIEW_ARGS(projectpackage), options.api_username);
       }
       else {
         /* /source/_my_packages/<project> */
-        my_p_path_format = "/search/package_id?match=person/@userid+=+'%s'+and+@project+=+'%s'";
-        my_p_path = malloc(strlen(my_p_path_format) + strlen(options.api_username) + strlen(projectpackage) + strlen(project));
-        sprintf(my_p_path, my_p_path_format, options.api_username, project + 1 /* skip leading slash */);
+        snprintf(my_p_path, sizeof(my_p_path), "/search/package_id?match=person/@userid+=+'%s'+and+@project+=+'%.*s'",
+                 options.api_username, project.len - 1, project.ptr + 1 /* skip leading slash */);
       }
       parse_dir(buf, filler, newdir, path, my_p_path, canon_path, NULL, NULL);
-      free(my_p_path);
-      free(projectpackage);
-      free(project);
     }
     /* It doesn't make sense to have a /build/_my_packages dir because the
        /build tree adds the architecture level, meaning that there is more
        than one directory for each package.  /build/_my_projects maps fine,
        though, and that's why it is handled here.  */
     else if (!strcmp("/build/_my_projects", canon_path)) {
-      const char *my_p_path_format = "/search/project_id?match=person/@userid+=+'%s'";
-      char *my_p_path = malloc(strlen(my_p_path_format) + strlen(options.api_username));
-      sprintf(my_p_path, my_p_path_format, options.api_username);
+      char my_p_path[API_PATH_MAX];
+      snprintf(my_p_path, sizeof(my_p_path), "/search/project_id?match=person/@userid+=+'%s'", options.api_username);
       parse_dir(buf, filler, newdir, path, my_p_path, canon_path, NULL, NULL);
-      free(my_p_path);
+    }
+    else if (!strcmp(NODE_CONTROL, canon_path)) {
+      /* obsfs' own status files, contents are generated in obsfs_open() */
+      struct stat st;
+      const char **n;
+      stat_default_file(&st);
+      for (n = control_nodes; *n; n++)
+        add_dir_node(buf, filler, newdir, path, *n, &st, NULL, NULL);
     }
     else if (!strcmp("/statistics", canon_path)) {
       struct stat st;
@@ -705,41 +1167,45 @@ static int get_api_dir(const char *path, void *buf, fuse_fill_dir_t filler)
     }
     else if (!regexec(&source_project_package, canon_path, 10, matches, 0)) {
       /* source directories are expanded by default */
-      char *expandpath = malloc(strlen(canon_path) + strlen("?expand=1") + 1);
-      sprintf(expandpath, "%s?expand=1", canon_path);
-      parse_dir(buf, filler, newdir, path, expandpath, canon_path, NULL, NULL);
-      free(expandpath);
+      char expandpath[API_PATH_MAX];
+      snprintf(expandpath, sizeof(expandpath), "%s?expand=1", canon_path);
+      /* with the project's source info, we know the srcmd5 in advance */
+      char srcmd5[MD5_HEX_LEN + 1], project[NAME_MAX + 1], package[NAME_MAX + 1];
+      int have_srcmd5 = 0;
+      if (options.prefetch_info &&
+          view_cpy(project, sizeof(project), match_view(matches[1], canon_path)) &&
+          view_cpy(package, sizeof(package), match_view(matches[2], canon_path)))
+        have_srcmd5 = !prjinfo_srcmd5(project, package, srcmd5);
+      parse_source_dir(buf, filler, newdir, path, expandpath, canon_path, have_srcmd5 ? srcmd5 : NULL);
     }
     else if (!regexec(&source_project_package_unexpanded, canon_path, 10, matches, 0)) {
       /* subdirectory containing unexpanded sources */
-      parse_dir(buf, filler, newdir, path, get_match(matches[1], canon_path), canon_path, NULL, NULL);
+      char api_path[PATH_MAX];
+      view_cpy(api_path, sizeof(api_path), match_view(matches[1], canon_path));
+      parse_dir(buf, filler, newdir, path, api_path, canon_path, NULL, NULL);
     }
     else if (!regexec(&source_project_package_rev, canon_path, 10, matches, 0)) {
       /* revisions directory containg all revisions of a package's sources */
-      char *package_path = get_match(matches[1], canon_path);
-      char *revpath = malloc(strlen(package_path) + strlen("/_history"));
-      sprintf(revpath, "%s/_history", package_path);
+      strview_t package_path = match_view(matches[1], canon_path);
+      char revpath[API_PATH_MAX];
+      snprintf(revpath, sizeof(revpath), "%.*s/_history", VIEW_ARGS(package_path));
       parse_dir(buf, filler, newdir, path, revpath, canon_path, NULL, NULL);
-      free(revpath);
-      free(package_path);
     }
     else if (!regexec(&source_project_package_rev_num, canon_path, 10, matches, 0)) {
       /* a specific source revision's directory */
-      char *package_path = get_match(matches[1], canon_path);
-      char *revision = get_match(matches[2], canon_path);
+      strview_t package_path = match_view(matches[1], canon_path);
+      strview_t revision = match_view(matches[2], canon_path);
       /* source directories are expanded by default */
-      char *expandpath = malloc(strlen(package_path) + strlen("?expand=1&rev=") + strlen(revision) + 1);
-      sprintf(expandpath, "%s?expand=1&rev=%s", package_path, revision);
-      parse_dir(buf, filler, newdir, path, expandpath, canon_path, NULL, NULL);
-      free(expandpath);
-      free(revision);
-      free(package_path);
+      char expandpath[API_PATH_MAX];
+      snprintf(expandpath, sizeof(expandpath), "%.*s?expand=1&rev=%.*s", VIEW_ARGS(package_path), VIEW_ARGS(revision));
+      parse_source_dir(buf, filler, newdir, path, expandpath, canon_path, NULL);
     }
-    else {
-      /* regular directory, no special handling */
+    else if (!options.bulk_build || get_build_dir(path, canon_path, buf, filler, newdir)) {
+      /* regular directory, no special handling; with bulk_build, built
+         packages and their binaries come from the project's build snapshot
+         instead if we can get it */
       parse_dir(buf, filler, newdir, path, canon_path, canon_path, NULL, NULL);
     }
-    free(canon_path);
     
     /* check if we need to add additional nodes */
     /* Most of the available API is not exposed through directories. We have to know
@@ -757,6 +1223,14 @@ static int get_api_dir(const char *path, void *buf, fuse_fill_dir_t filler)
         stat_default_dir(&st);
         add_dir_node(buf, filler, newdir, path, NODE_FAILED, &st, NULL, NULL);
       }
+      /* build/<project>/_summary{,.tsv,.json} */
+      if (!regexec(&build_project, path, 0, matches, 0)) {
+        struct stat st;
+        const char **n;
+        stat_default_file(&st);
+        for (n = summary_nodes; *n; n++)
+          add_dir_node(buf, filler, newdir, path, *n, &st, NULL, NULL);
+      }
       /* log, history, status, and reason for packages */
       if (regexec(&build_project_repo_arch_failed, path, 0, matches, 0)
           && !regexec(&build_project_repo_arch_foo, path, 0, matches, 0)) {
@@ -778,20 +1252,23 @@ static int get_api_dir(const char *path, void *buf, fuse_fill_dir_t filler)
     else if (!regexec(&source_project_package, path, 3, matches, 0)) {
       struct stat st;
       stat_default_file(&st);
-      const char *sf = "/statistics/%s/%s/%s";	/* hardlink to statistics tree */
-      char *project = get_match(matches[1], path);
-      char *package = get_match(matches[2], path);
-      char *hardlink = malloc(strlen(sf) + strlen("activity") + strlen(project) + strlen(package));
-      sprintf(hardlink, sf, "activity", project, package);
+      const char *sf = "/statistics/%s/%.*s/%.*s";	/* hardlink to statistics tree */
+      strview_t project = match_view(matches[1], path);
+      strview_t package = match_view(matches[2], path);
+      char hardlink[API_PATH_MAX];
+      snprintf(hardlink, sizeof(hardlink), sf, "activity", VIEW_ARGS(project), VIEW_ARGS(package));
       add_dir_node(buf, filler, newdir, path, "_activity", &st, NULL, hardlink);
-      sprintf(hardlink, sf, "rating", project, package);
+      snprintf(hardlink, sizeof(hardlink), sf, "rating", VIEW_ARGS(project), VIEW_ARGS(package));
       add_dir_node(buf, filler, newdir, path, "_rating", &st, NULL, hardlink);
-      free(hardlink);
       add_dir_node(buf, filler, newdir, path, "_meta", &st, NULL, NULL);
       add_dir_node(buf, filler, newdir, path, "_history", &st, NULL, NULL);
+      if (commit_enabled())
+        add_dir_node(buf, filler, newdir, path, COMMIT_NODE, &st, NULL, NULL);
       /* revisions subdirectory */
       stat_make_dir(&st);
       add_dir_node(buf, filler, newdir, path, "_rev", &st, NULL, NULL);
+      if (prefetch_patterns)
+        prefetch_package_files(path, newdir);
     }
     /* add _my_packages to /source and _my_packages and _my_projects to /source */
     else if (!strcmp("/source", path) || !strcmp("/build", path)) {
@@ -802,6 +1279,11 @@ static int get_api_dir(const char *path, void *buf, fuse_fill_dir_t filler)
         add_dir_node(buf, filler, newdir, path, "_my_packages", &st, NULL, NULL);
     }
     else if (!regexec(&source_project, path, 2, matches, 0)) {
+      /* Somebody listing a project is likely to look at its packages next,
+         so we get the source info for all of them right away. */
+      char project[NAME_MAX + 1];
+      if (options.prefetch_info && view_cpy(project, sizeof(project), match_view(matches[1], path)))
+        prjinfo_fetch(project);
       /* /source/<project>/_meta */
       struct stat st;
       stat_default_file(&st);
@@ -811,6 +1293,7 @@ static int get_api_dir(const char *path, void *buf, fuse_fill_dir_t filler)
         add_dir_node(buf, filler, newdir, path, *n, &st, NULL, NULL);
       }
     }
+    dir_cache_put(newdir);
   }
   return 0;
 }
@@ -840,156 +1323,474 @@ static int obsfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
     return 0;
   }
   else {
-    /* If it's not the root directory, we get it from the API server (or dir cache). */
+    /* If it's not the root directory, we get it from the API server (or dir
+       cache); if it is being prefetched, the latter, in a moment. */
+    prefetch_wait(path);
+    if (filler)
+      prefetch_readahead(path, prefetch_dir);
     return get_api_dir(path, buf, filler);
   }
 }
 
-/* retrieve a file, store it in our local file cache, and return a descriptor
-   to the local copy */
-static int obsfs_open(const char *path, struct fuse_file_info *fi)
+/* write the contents of the control file "name" to "fp"; returns -1 if
+   there is no such file */
+static int control_file(const char *name, FILE *fp)
+{
+  if (!strcmp(name, "writeback"))
+    writeback_report(fp);
+  else if (!strcmp(name, "commit"))
+    commit_report(fp);
+  else if (!strcmp(name, "cache"))
+    cache_report(fp);
+  else if (!strcmp(name, "log"))
+    log_report(fp);
+  else
+    return -1;
+  return 0;
+}
+
+/* build the contents of API files that we can make up from data we already
+   have ourselves, or from parts of other API files; returns -1 if "path" has
+   to be retrieved from the server */
+static int generate_file(const char *path, FILE *fp)
+{
+  regmatch_t matches[10];
+  int ret = -1;
+  
+  char project[NAME_MAX + 1], repo[NAME_MAX + 1], arch[NAME_MAX + 1], package[NAME_MAX + 1];
+  
+  if (!strncmp(path, "/build/", 7) && endswith(path, "/" NODE_LOG_TAIL)) {
+    /* the end of a build log */
+    char log_path[PATH_MAX];
+    if (view_cpy(log_path, sizeof(log_path), (strview_t){ path, strlen(path) - strlen(".tail") }))
+      ret = buildlog_tail(log_path, (off_t)options.log_tail * 1024, fp);
+  }
+  else if (!regexec(&build_project_summary, path, 10, matches, 0)) {
+    /* build results of all packages in a project */
+    strview_t node = match_view(matches[2], path);
+    int format;
+    for (format = 0; summary_nodes[format]; format++) {
+      if (strlen(summary_nodes[format]) == (size_t)node.len && !memcmp(node.ptr, summary_nodes[format], node.len))
+        break;
+    }
+    if (summary_nodes[format] && view_cpy(project, sizeof(project), match_view(matches[1], path)))
+      ret = buildinfo_summary(project, format, fp);
+  }
+  else if (options.bulk_build &&
+           !regexec(&build_project_repo_arch_package_status, path, 10, matches, 0)) {
+    /* the status of a package is part of the project's build results */
+    if (view_cpy(project, sizeof(project), match_view(matches[1], path)) &&
+        view_cpy(repo, sizeof(repo), match_view(matches[2], path)) &&
+        view_cpy(arch, sizeof(arch), match_view(matches[3], path)) &&
+        view_cpy(package, sizeof(package), match_view(matches[4], path)) &&
+        !buildinfo_result(project))
+      ret = buildinfo_status(project, repo, arch, package, fp);
+  }
+  return ret;
+}
+
+/* where a download goes: into memory as long as it is small enough, into
+   the file cache otherwise */
+typedef struct {
+  FILE *fp;		/* cache file, once we have one */
+  const char *path;
+  const char *relpath;	/* name of the cache file */
+  char *data;		/* in-memory copy */
+  size_t len;
+  size_t max;		/* spill to the cache file beyond this size */
+  int compress;		/* compress the cache file if it turns out to be text */
+  zfile_t *z;		/* compressed cache file */
+} sink_t;
+
+static size_t sink_write(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+  sink_t *sink = (sink_t *)userdata;
+  size_t n = size * nmemb;
+  if (!sink->fp && sink->len + n > sink->max) {
+    /* too big for memory, move everything to the file cache */
+    if (mkdirp(sink->relpath, 0755) || !(sink->fp = fopen(sink->relpath, "w+")))
+      return 0;
+    if (sink->len) {
+      char *data = sink->data;
+      size_t len = sink->len;
+      sink->data = NULL;
+      sink->len = 0;
+      len = sink_write(data, 1, len, sink) == len;
+      free(data);
+      if (!len)
+        return 0;
+    }
+  }
+  if (sink->fp) {
+    /* the first data to go to the cache file decides if it is compressed */
+    if (sink->compress) {
+      sink->compress = 0;
+      if (zcache_is_text(ptr, n))
+        sink->z = zcache_create(sink->path, fileno(sink->fp));
+    }
+    if (sink->z)
+      return zcache_append(sink->z, ptr, n) ? 0 : n;
+    return fwrite(ptr, size, nmemb, sink->fp) * size;
+  }
+  sink->data = realloc(sink->data, sink->len + n);
+  memcpy(sink->data + sink->len, ptr, n);
+  sink->len += n;
+  return n;
+}
+
+/* retrieve the API file behind "path" into "sink" */
+static void download_file(const char *path, attr_t *at, sink_t *sink)
 {
   char *urlbuf;
   CURL *curl;
-  FILE *fp;
   CURLcode ret;
+  
+  /* find out if this file is supposed to hardlink somewhere */
+  const char *effective_path = path;
+  if (at && at->hardlink) {
+    effective_path = at->hardlink;
+  }
+
+  /* compose the full URL */
+  urlbuf = make_url(url_prefix, effective_path, file_rev(effective_path, at));
+  
+  /* retrieve the file from the API server */
+  DEBUG("getting URL %s\n", urlbuf);
+  curl = curl_open_file(urlbuf, NULL, NULL, sink_write, sink);
+  ret = http_perform(curl);
+  http_close(curl);
+  if (ret) {
+    LOG(LOG_HTTP, LEVEL_ERROR, "curl error %d\n", ret);
+  }
+  free(urlbuf);
+}
+
+/* how long the cached contents of "path" are good for; the tail of a build
+   log keeps changing until the package is done building */
+static time_t file_cache_timeout(const char *path)
+{
+  regmatch_t matches[10];
+  char project[NAME_MAX + 1], repo[NAME_MAX + 1], arch[NAME_MAX + 1], package[NAME_MAX + 1];
+  int finished = 0;
+  
+  if (regexec(&build_project_repo_arch_package_tail, path, 10, matches, 0))
+    return FILE_CACHE_TIMEOUT;
+  if (view_cpy(project, sizeof(project), match_view(matches[1], path)) &&
+      view_cpy(repo, sizeof(repo), match_view(matches[2], path)) &&
+      view_cpy(arch, sizeof(arch), match_view(matches[3], path)) &&
+      view_cpy(package, sizeof(package), match_view(matches[4], path)) &&
+      !buildinfo_result(project))
+    finished = buildinfo_finished(project, repo, arch, package);
+  return finished ? FILE_CACHE_TIMEOUT : LOG_TAIL_TIMEOUT;
+}
+
+/* retrieve a file into the cache entry "key", which is kept in our local
+   file cache (or in memory, if it is small), and return a handle to the
+   local copy; "at" is the attribute cache entry of "path", if any */
+static int open_entry_at(const char *path, const char *key, struct fuse_file_info *fi, attr_t *at)
+{
+  FILE *fp;
   struct stat st;
-  const char *relpath = path + 1; /* skip leading slash */
-  attr_t *at = attr_cache_find(path);
+  const char *relpath = key + 1; /* skip leading slash */
+  file_t *f;
+  mem_t *m;
+  int is_control = !strncmp(path, NODE_CONTROL "/", strlen(NODE_CONTROL "/"));
+  int is_summary = !regexec(&build_project_summary, path, 0, NULL, 0);
+  int is_commit = commit_enabled() && endswith(path, "/" COMMIT_NODE);
+  int writing = (fi->flags & O_ACCMODE) != O_RDONLY;
+  const char *effective_path = at && at->hardlink ? at->hardlink : path;
+  int is_log = buildlog_is_log(effective_path);
+  time_t timeout = file_cache_timeout(effective_path);
+  
+  /* control files and summaries are generated anew every time they are
+     opened; the summaries come from the build results, which have their own
+     cache */
+  if (is_control || is_summary)
+    unlink(relpath);
+  
+  /* small files may be held in memory, unless somebody wants to write them */
+  if ((m = memcache_get(key))) {
+    if (time(NULL) - m->timestamp > timeout || cache_tree_changed(key, m->timestamp)) {
+      DEBUG("OPEN: expiring in-memory file %s\n", path);
+      memcache_release(m);
+      memcache_remove(key);
+    }
+    else if (writing) {
+      memcache_release(m);
+      if (memcache_spill(key))
+        return -EIO;
+    }
+    else
+      goto have_mem;
+  }
   
   /* discard unmodified cached files that have expired */
   if (!lstat(relpath, &st)) {
-    if (at && !at->modified && (time(NULL) - st.st_mtime) > FILE_CACHE_TIMEOUT) {
+    /* build logs are brought up to date instead */
+    if (at && !at->modified && !is_log &&
+        ((time(NULL) - st.st_mtime) > timeout || cache_tree_changed(path, st.st_mtime) || cache_tree_changed(key, st.st_mtime))) {
       DEBUG("OPEN: expiring cached file %s\n", path);
       unlink(relpath);
+      zcache_remove(key);
     }
   }
 
+  /* compressed files are expanded before they are modified */
+  if (writing && zcache_expand(key))
+    return -EIO;
+
   fp = fopen(relpath, "r+");
   if (!fp) {
-    /* create the cache file */
-    if (mkdirp(relpath, 0755))
-      return -errno;
-    fp = fopen(relpath, "w+");
-    if (!fp)
-      return -EIO;
-  
-    /* find out if this file is supposed to hardlink somewhere */
-    const char *effective_path = path;
-    if (at && at->hardlink) {
-      effective_path = at->hardlink;
+    sink_t sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.path = key;
+    sink.relpath = relpath;
+    sink.compress = !options.nocompress && !writing && !is_control && !is_summary && !is_commit;
+    
+    if (writing || is_control || is_summary || is_commit || is_log || !memcache_max_file()) {
+      /* create the cache file */
+      if (mkdirp(relpath, 0755))
+        return -errno;
+      fp = fopen(relpath, "w+");
+      if (!fp)
+        return -EIO;
+      sink.fp = fp;
     }
-
-    /* In an expanded source directory, all files are retrieved with a
-       "rev=..." parameter (the revision is stored in the dir cache
-       entry and is added by make_url()); this is no good for the status
-       APIs, particularly _history, which would only display one revision
-       then. We therefore have to make an exception for these nodes and
-       not specify a revision when retrieving them. */
-    const char *rev;
-    if (at) {
-      const char **s;
-      rev = at->rev;
-      for (s = status_api; *s; s++) {
-        if (strstr(effective_path, *s)) {
-          rev = NULL;
-          break;
-        }
-      }
+    else {
+      /* keep it in memory if it turns out to be small */
+      sink.max = memcache_max_file();
     }
-    else
-      rev = NULL;
     
-    /* compose the full URL */
-    urlbuf = make_url(url_prefix, effective_path, rev);
+    /* the commit trigger node only exists locally, and build logs are
+       retrieved piece by piece below */
+    if (is_log && sink.compress)
+      zcache_release(zcache_create(key, fileno(fp)));
+    if (is_commit || is_log)
+      goto have_file;
     
-    /* retrieve the file from the API server */
-    DEBUG("getting URL %s\n", urlbuf);
-    curl = curl_open_file(urlbuf, NULL, NULL, fwrite, fp);
-    ret = curl_easy_perform(curl);
-    curl_easy_cleanup(curl);
-    if (ret) {
-      fprintf(stderr,"curl error %d\n", ret);
+    /* control files that are written to take settings instead */
+    if (is_control && writing)
+      goto have_file;
+    if (is_control) {
+      if (control_file(path + strlen(NODE_CONTROL "/"), fp)) {
+        fclose(fp);
+        unlink(relpath);
+        return -ENOENT;
+      }
+      fflush(fp);
+      goto have_file;
+    }
+    
+    /* generate the file if we can, download it otherwise */
+    char *gen_data;
+    size_t gen_len;
+    FILE *gen = open_memstream(&gen_data, &gen_len);
+    if (!generate_file(effective_path, gen)) {
+      fclose(gen);
+      if (sink_write(gen_data, 1, gen_len, &sink) != gen_len) {
+        free(gen_data);
+        if (sink.z) {
+          zcache_release(sink.z);
+          zcache_remove(key);
+        }
+        if (sink.fp)
+          fclose(sink.fp);
+        free(sink.data);
+        return -EIO;
+      }
+    }
+    else {
+      fclose(gen);
+      download_file(path, at, &sink);
+    }
+    free(gen_data);
+    if (!sink.fp) {
+      m = memcache_put(key, sink.data, sink.len);
+      goto have_mem;
+    }
+    fp = sink.fp;
+    fflush(fp);
+    if (sink.z) {
+      zcache_flush(sink.z);
+      zcache_release(sink.z);
     }
-    free(urlbuf);
   }
   
+have_file:
   /* create a new file handle for the cache file, we need it later to retrieve
      the contents */
-  fi->fh = dup(fileno(fp));
+  f = calloc(1, sizeof(file_t));
+  f->fd = dup(fileno(fp));
+  f->z = zcache_get(key);
+  f->md5 = g_checksum_new(G_CHECKSUM_MD5);
+  fi->fh = (uintptr_t)f;
   fclose(fp);
+  
+  /* get the part of the log we don't have yet; if we have something
+     already, check that it's still the same log */
+  if (is_log) {
+    f->log = buildlog_open(key, effective_path, f->fd);
+    buildlog_update(f->log, 1);
+  }
 
   /* now that we have the actual size, update the stat cache; this is necessary
      for the special nodes, the sizes of which we don't know when constructing
      their directory entries */
-  if (fstat(fi->fh, &st)) {
+  if (fstat(f->fd, &st)) {
     perror("fstat");
   }
+  zcache_size(key, &st.st_size);
   attr_cache_add(path, &st, at? at->symlink : NULL, at? at->hardlink : NULL, at? at->rev : NULL);
 
   return 0;
+
+have_mem:
+  f = calloc(1, sizeof(file_t));
+  f->fd = -1;
+  f->mem = m;
+  fi->fh = (uintptr_t)f;
+  
+  if (at)
+    st = at->st;
+  else
+    stat_default_file(&st);
+  st.st_size = m->len;
+  attr_cache_add(path, &st, at? at->symlink : NULL, at? at->hardlink : NULL, at? at->rev : NULL);
+  
+  return 0;
+}
+
+static int open_entry(const char *path, const char *key, struct fuse_file_info *fi)
+{
+  attr_t *at = attr_cache_find(path);
+  int ret = open_entry_at(path, key, fi, at);
+  attr_cache_put(at);
+  return ret;
+}
+
+static int open_file(const char *path, struct fuse_file_info *fi)
+{
+  int ret;
+  char keybuf[API_PATH_MAX];
+  const char *key = path;
+  /* aliases are written to under their own path */
+  if ((fi->flags & O_ACCMODE) == O_RDONLY) {
+    attr_t *at = attr_cache_find(path);
+    key = cache_key(path, at, keybuf, sizeof(keybuf));
+    attr_cache_put(at);
+  }
+  fill_lock(key);
+  ret = open_entry(path, key, fi);
+  fill_unlock(key);
+  return ret;
+}
+
+/* read from a cache file, compressed or not; returns -errno on error */
+static ssize_t read_cache_file(file_t *f, char *buf, size_t size, off_t offset)
+{
+  if (f->z)
+    return zcache_pread(f->z, buf, size, offset);
+  ssize_t ret = pread(f->fd, buf, size, offset);
+  return ret < 0 ? -errno : ret;
 }
 
 static int obsfs_read(const char *path, char *buf, size_t size, off_t offset,
                       struct fuse_file_info *fi)
 {
-  /* read from the cache file */
-  int ret = pread(fi->fh, buf, size, offset);
+  file_t *f = FILE_T(fi);
+  
+  /* read from memory... */
+  if (f->mem) {
+    if (offset >= f->mem->len)
+      return 0;
+    size = min(size, f->mem->len - offset);
+    memcpy(buf, f->mem->data + offset, size);
+    return size;
+  }
+  
+  /* ...or from the cache file */
+  int ret = read_cache_file(f, buf, size, offset);
   if (ret < 0)
-    return -errno;
-  else
     return ret;
+  
+  /* a reader at the end of a build log may be waiting for more */
+  if (f->log && ret < size) {
+    if (buildlog_refresh(f->log) > offset + ret) {
+      int more = read_cache_file(f, buf + ret, size - ret, offset + ret);
+      if (more > 0)
+        ret += more;
+    }
+    if (offset + ret > f->log_seen)
+      f->log_seen = offset + ret;
+  }
+  return ret;
 }
 
 static int obsfs_write(const char *path, const char *buf, size_t size, off_t offset,
                        struct fuse_file_info *fi)
 {
-  attr_t *at = attr_cache_find(path);
-  if (!at) {
+  unsigned long gen;
+  file_t *f = FILE_T(fi);
+  if (f->mem)
+    return -EBADF;	/* in-memory files are read-only */
+  if (attr_cache_set_modified(path, offset + size, &gen)) {
     DEBUG("WRITE: internal error writing to %s\n", path);
     return -EIO;
   }
-  if (!at->modified) {
-    at->modified = 1;
-    char *dn = dirname_c(path, NULL);
-    dir_t *dir = dir_cache_find(dn);
-    free(dn);
-    if (dir) {
-      dir->modified++;
+  
+  int ret = pwrite(f->fd, buf, size, offset);
+  int alone = attr_cache_written(path) == gen + 1;
+  if (ret < 0)
+    return -errno;
+  
+  /* keep track of the MD5 sum as long as the file is written from start
+     to end, which is what most programs do, and nobody else writes to it
+     at the same time */
+  if (f->md5) {
+    if (offset == f->md5_len && alone) {
+      g_checksum_update(f->md5, (const guchar *)buf, ret);
+      f->md5_len += ret;
+      f->md5_gen = gen + 1;
+    }
+    else {
+      g_checksum_free(f->md5);
+      f->md5 = NULL;
     }
   }
-  if (offset + size > at->st.st_size)
-    at->st.st_size = offset + size;
-  return pwrite(fi->fh, buf, size, offset);
+  return ret;
 }
 
-static int obsfs_truncate(const char *path, off_t offset)
+/* compute the MD5 sum of an open file, using the sum collected while
+   writing if it covers the whole file and nobody has written to the file
+   through another handle since */
+static int file_md5(file_t *f, attr_t *at, const char *path, char *md5)
 {
-  return truncate(path + 1, offset);
+  struct stat st;
+  if (f->md5 && f->md5_gen == at->writes && !fstat(f->fd, &st) && st.st_size == f->md5_len) {
+    /* g_checksum_get_string() closes the checksum, and there may be more
+       writes to come */
+    GChecksum *cs = g_checksum_copy(f->md5);
+    strcpy(md5, g_checksum_get_string(cs));
+    g_checksum_free(cs);
+    return 0;
+  }
+  return md5_file(path + 1 /* skip leading slash */, md5);
 }
 
-/* Giving it a NULL pointer as the reader function doesn't deter curl from
-   using fwrite() anyway, so we need this expceptionally useless function. */
-static size_t write_null(void *ptr, size_t size, size_t nmemb, void *userdata)
+static int obsfs_truncate(const char *path, off_t offset)
 {
-  (void)ptr;
-  (void)userdata;
-  return size * nmemb;
+  if (memcache_spill(path) || zcache_expand(path))
+    return -EIO;
+  if (truncate(path + 1, offset))
+    return -errno;
+  /* MD5 sums collected by open handles no longer apply */
+  attr_cache_written(path);
+  return 0;
 }
 
-static int obsfs_flush(const char *path, struct fuse_file_info *fi)
+static int flush_entry(const char *path, struct fuse_file_info *fi, attr_t *at)
 {
   int ret;
-  FILE *fp;
-  DEBUG("FLUSH: flushing %s\n", path);
-  
-  /* If the file is being flushed, we have seen it before, so it's in the attr cache. */
-  /* FIXME: What if it has expired there? */
-  attr_t *at = attr_cache_find(path);
-  if (!at) {
-    DEBUG("FLUSH: internal error flushing %s\n", path);
-    return -EIO;
-  }
   
   /* If it has been modified, we need to write it back to the API server. */
   if (at->modified) {
@@ -999,64 +1800,156 @@ static int obsfs_flush(const char *path, struct fuse_file_info *fi)
     if (at && at->hardlink) {
       effective_path = at->hardlink;
     }
-    char *url = make_url(url_prefix, effective_path, NULL); /* no revision here, we're creating a new one */
     
-    if (lseek(fi->fh, 0, SEEK_SET) < 0)
-      return -errno;
-      
-    /* curl likes fread(), so we get us a FILE pointer */
-    fp = fdopen(dup(fi->fh), "r");
-    if (!fp) {
-      perror("fdopen");
-      return -errno;
+    /* writing to a control file changes settings; it is never uploaded */
+    if (!strncmp(path, NODE_CONTROL "/", strlen(NODE_CONTROL "/"))) {
+      char text[1024];
+      ssize_t len = pread(FILE_T(fi)->fd, text, sizeof(text) - 1, 0);
+      text[len > 0 ? len : 0] = 0;
+      attr_cache_clear_modified(path);
+      ftruncate(FILE_T(fi)->fd, 0);
+      if (!strcmp(path, NODE_CONTROL "/log"))
+        return log_set(text) ? -EINVAL : 0;
+      return -EACCES;
     }
     
-    status_t *status = xml_status_init();
-
-    /* prepare for uploading the file */
-    CURL *curl = curl_open_file(url, fread, fp, xml_status_write, status);
-    curl_easy_setopt(curl, CURLOPT_UPLOAD, 1);
-    
-    /* need to tell curl about the file size */
-    struct stat st;
-    fstat(fi->fh, &st);
-    curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, st.st_size);
+    /* writing to the "_commit" node commits the package, using what has
+       been written as the commit message */
+    if (commit_enabled() && endswith(path, "/" COMMIT_NODE)) {
+      char comment[1024];
+      ssize_t len = pread(FILE_T(fi)->fd, comment, sizeof(comment) - 1, 0);
+      comment[len > 0 ? len : 0] = 0;
+      if (len > 0 && comment[len - 1] == '\n')
+        comment[len - 1] = 0;
+      attr_cache_clear_modified(path);
+      ftruncate(FILE_T(fi)->fd, 0);
+      return commit_path(effective_path, comment[0] ? comment : NULL);
+    }
     
-    /* do it! */
-    ret = curl_easy_perform(curl);
-    curl_easy_cleanup(curl);
-    fclose(fp);
-
-    int s = xml_get_status(status);
-    xml_status_destroy(status);
-    if (s) {
-      fprintf(stderr, "FLUSH: BS status %d\n", s);
-      return -s;
+    /* Tools often rewrite files with identical contents; if the server
+       already has what we have, there is nothing to upload. */
+    char md5[MD5_HEX_LEN + 1];
+    if (at->md5 && !file_md5(FILE_T(fi), at, path, md5) && !strcmp(md5, at->md5)) {
+      DEBUG("FLUSH: %s is unchanged, not uploading\n", path);
+      attr_cache_clear_modified(path);
+      return 0;
     }
     
-    if (ret) {
-      fprintf(stderr,"FLUSH: curl error %d\n", ret);
+    /* in batch mode, package sources are uploaded with the next commit
+       of their package */
+    if (!commit_stage(path, effective_path, 0))
+      return 0;
+    
+    /* normally, the upload happens in the background */
+    if (!writeback_queue(path, effective_path))
+      return 0;
+    
+    ret = writeback_upload(path, effective_path, NULL, NULL); /* no revision here, we're creating a new one */
+    if (ret == -EIO) {
       /* if the CURL upload failed, we better not rely on anything we have
          cached locally anymore */
       attr_cache_remove(path);
       dir_cache_remove(path);
-      return -EIO; /* as the FUSE docs point out, this is most often ignored... */
+      return ret; /* as the FUSE docs point out, this is most often ignored... */
     }
+    if (ret)
+      return ret;
+    prjinfo_invalidate_path(effective_path);
     
-    at->modified = 0;
-    char *dn = dirname_c(path, NULL);
-    dir_t *dir = dir_cache_find(dn);
-    free(dn);
-    if (dir) {
-      dir->modified--;
-    }
+    if (!md5_file(path + 1, md5))
+      attr_cache_set_md5(at, md5);
+    attr_cache_clear_modified(path);
   }
   return 0;
 }
 
+static int obsfs_flush(const char *path, struct fuse_file_info *fi)
+{
+  int ret;
+  DEBUG("FLUSH: flushing %s\n", path);
+  
+  /* If the file is being flushed, we have seen it before, so it's in the attr cache. */
+  /* FIXME: What if it has expired there? */
+  attr_t *at = attr_cache_find(path);
+  if (!at) {
+    DEBUG("FLUSH: internal error flushing %s\n", path);
+    return -EIO;
+  }
+  ret = flush_entry(path, fi, at);
+  attr_cache_put(at);
+  return ret;
+}
+
+static int obsfs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+  (void)datasync;
+  int ret = obsfs_flush(path, fi);
+  if (ret)
+    return ret;
+  if (!commit_enabled())
+    return writeback_sync(path);
+  
+  /* make sure the staged changes actually end up on the server */
+  attr_t *at = attr_cache_find(path);
+  ret = commit_path(at && at->hardlink ? at->hardlink : path, NULL);
+  attr_cache_put(at);
+  return ret;
+}
+
+static int obsfs_open(const char *path, struct fuse_file_info *fi)
+{
+  /* if the file is being prefetched, let that finish first */
+  prefetch_wait(path);
+  return open_file(path, fi);
+}
+
+static int obsfs_release(const char *path, struct fuse_file_info *fi);
+
+/* prefetch job for files */
+static void prefetch_file(const char *path)
+{
+  struct fuse_file_info fi;
+  memset(&fi, 0, sizeof(fi));
+  fi.flags = O_RDONLY;
+  if (!open_file(path, &fi))
+    obsfs_release(path, &fi);
+}
+
 static int obsfs_release(const char *path, struct fuse_file_info *fi)
 {
-  return close(fi->fh);
+  file_t *f = FILE_T(fi);
+  int ret = 0;
+  if (f->mem)
+    memcache_release(f->mem);
+  else
+    ret = close(f->fd);
+  if (f->log) {
+    buildlog_unpoll(f->log, f);
+    buildlog_close(f->log);
+  }
+  if (f->z)
+    zcache_release(f->z);
+  if (f->md5)
+    g_checksum_free(f->md5);
+  free(f);
+  return ret;
+}
+
+/* poll() is only interesting for build logs; everything else is always
+   readable */
+static int obsfs_poll(const char *path, struct fuse_file_info *fi,
+                      struct fuse_pollhandle *ph, unsigned *reventsp)
+{
+  file_t *f = FILE_T(fi);
+  if (!f->log) {
+    if (ph)
+      fuse_pollhandle_destroy(ph);
+    *reventsp |= POLLIN | POLLOUT;
+    return 0;
+  }
+  if (buildlog_poll(f->log, f, f->log_seen, ph))
+    *reventsp |= POLLIN;
+  return 0;
 }
 
 static int obsfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
@@ -1066,8 +1959,13 @@ static int obsfs_create(const char *path, mode_t mode, struct fuse_file_info *fi
   
   /* create a new cache file */
   mkdirp(path + 1, 0755);
-  if ((fi->fh = open(path + 1 /* skip slash */, O_CREAT|O_RDWR|O_TRUNC, mode)) < 0)
+  int fd = open(path + 1 /* skip slash */, O_CREAT|O_RDWR|O_TRUNC, mode);
+  if (fd < 0)
     return -errno;
+  file_t *f = calloc(1, sizeof(file_t));
+  f->fd = fd;
+  f->md5 = g_checksum_new(G_CHECKSUM_MD5);
+  fi->fh = (uintptr_t)f;
   
   /* create a new attr cache entry for that file */
   stat_default_file(&st);
@@ -1077,17 +1975,17 @@ static int obsfs_create(const char *path, mode_t mode, struct fuse_file_info *fi
   /* add it to its directory in the cache */
   /* FIXME: It won't appear in the upstream directory until the next flush,
      might cause inconsistencies. */
-  char *bn, *dn;
-  dn = dirname_c(path, &bn);
-  dir_t *dir = dir_cache_find(dn);
+  const char *bn;
+  char dn[PATH_MAX];
+  dir_t *dir = dirname_buf(path, dn, sizeof(dn), &bn) ? NULL : dir_cache_find(dn);
   if (dir) {
     dir_cache_add(dir, bn, 0);
     /* FIXME: We should increment dir->modified here, but we can't because
        we don't set the modified flag in the newly created attribute so as
        not to sync an empty file needlessly, so dir->modified would never be
        reset...  */
+    dir_cache_put(dir);
   }
-  free(dn);
   
   return 0;
 }
@@ -1099,20 +1997,28 @@ static int obsfs_unlink(const char *path)
   DEBUG("UNLINK %s\n", path);
   
   /* remove node from the attribute and directory caches */
+  attr_cache_clear_modified(path);
   attr_cache_remove(path);
   dir_cache_remove(path);
+  writeback_cancel(path);
+  memcache_remove(path);
+  zcache_remove(path);
   
   /* remove node from file cache */
   ret = unlink(path + 1);
   rerrno = errno;
   
+  /* in batch mode, the deletion goes into the next commit of the package */
+  if (!commit_stage(path, path, 1))
+    return 0;
+  
   /* remove node from server */
   char *url = make_url(url_prefix, path, NULL); /* no revision when unlinking */
   CURL *curl = curl_open_file(url, NULL, NULL, write_null, NULL);
   curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
   
-  cret = curl_easy_perform(curl);
-  curl_easy_cleanup(curl);
+  cret = http_perform(curl);
+  http_close(curl);
   if (cret) {
     DEBUG("UNLINK: curl error %d\n", cret);
     if (ret) {
@@ -1123,6 +2029,7 @@ static int obsfs_unlink(const char *path)
       return 0;
   }
   /* if either unlink() or DELETE on the server worked OK, we're fine */
+  prjinfo_invalidate_path(path);
   return 0;
 }
 
@@ -1139,7 +2046,7 @@ static int obsfs_rmdir(const char *path)
   
   attr_cache_remove(path);
   dir_cache_remove(path); /* removes "path" from its parent directory */
-  /* FIXME: What about the dir cache entry of "path" itself? */
+  cache_invalidate_tree(path); /* and everything we had of "path" itself */
   
   /* OK, cached copy was removed (or didn't even exist to begin with), so we
      can now proceed to deleting it on the server. */
@@ -1152,8 +2059,8 @@ static int obsfs_rmdir(const char *path)
   CURL *curl = curl_open_file(url, NULL, NULL, write_null, NULL);
   curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
   
-  cret = curl_easy_perform(curl);
-  curl_easy_cleanup(curl);
+  cret = http_perform(curl);
+  http_close(curl);
   if (cret) {
     DEBUG("RMDIR: curl error %d\n", cret);
     if (ret) {
@@ -1163,6 +2070,7 @@ static int obsfs_rmdir(const char *path)
     else
       return 0;
   }
+  prjinfo_invalidate_path(path);
   return 0;
 }
 
@@ -1224,24 +2132,26 @@ static int create_meta_file(const char *meta, const char *path)
   /* prepare for uploading the meta file */
   CURL *curl = curl_open_file(url, string_read, &str, xml_status_write, status);
   curl_easy_setopt(curl, CURLOPT_UPLOAD, 1);
+  curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, string_seek);
+  curl_easy_setopt(curl, CURLOPT_SEEKDATA, &str);
   
   /* need to tell curl about the file size */
   curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, strlen(meta));
   
   /* do it! */
   int ret;
-  ret = curl_easy_perform(curl);
-  curl_easy_cleanup(curl);
+  ret = http_perform(curl);
+  http_close(curl);
   
   int s = xml_get_status(status);
   xml_status_destroy(status);
   if (s) {
-    fprintf(stderr, "MKDIR: BS status %d\n", s);
+    LOG(LOG_HTTP, LEVEL_ERROR, "MKDIR: BS status %d\n", s);
     return -s;
   }
 
   if (ret) {
-    fprintf(stderr,"MKDIR: curl error %d\n", ret);
+    LOG(LOG_HTTP, LEVEL_ERROR, "MKDIR: curl error %d\n", ret);
     return -EIO;
   }
 
@@ -1267,7 +2177,9 @@ static int obsfs_mkdir(const char *path, mode_t mode)
      we don't have to do that.  */
   
   /* we do have to check if it already exists, though */
-  if (attr_cache_find(path)) {
+  attr_t *at = attr_cache_find(path);
+  if (at) {
+    attr_cache_put(at);
     return -EEXIST;
   }
   
@@ -1303,10 +2215,13 @@ static void *obsfs_init(struct fuse_conn_info *conn)
     abort();
   }
 
+  /* messages are written out by a thread of their own from now on */
+  log_init();
+
   /* If we let libcurl create the cookie file, it will make it
      world-readable, and there doesn't seem to be an easy way to prevent
      that, so we just create an empty file with proper permissions here. */
-  int c = open("cookies", O_CREAT, 0600);
+  int c = open(COOKIE_JAR, O_CREAT, 0600);
   if (c < 0) {
     perror("open");
     abort();
@@ -1314,20 +2229,35 @@ static void *obsfs_init(struct fuse_conn_info *conn)
   close(c);
   
   /* construct an URL prefix from API server host name, user name and password */
-  const char *host;
-  if (options.api_hostname)
-    host = options.api_hostname;
-  else
-    host = DEFAULT_HOST;
-  url_prefix = malloc(strlen(host) + strlen("https://") + 1);
-  sprintf(url_prefix, "https://%s", host);
+  http_init(options.api_hostname ? : DEFAULT_HOST, options.api_username, options.api_password);
+
+  commit_init(options.commit_delay);
+  writeback_init(options.writeback_threads, options.upload_rate);
+  memcache_init((size_t)options.memcache_size * 1024, (size_t)options.memcache_file * 1024);
+  buildlog_init();
+  prefetch_init(options.prefetch_threads);
+  if (options.triage)
+    triage_init(options.triage_conns, options.triage_budget, prefetch_file);
+  changes_init(options.changes, drop_file);
+  if (options.build_watch)
+    buildwatch_init();
 
   return NULL;
 }
 
 static void obsfs_destroy(void *foo)
 {
-  free(url_prefix);
+  changes_destroy();
+  buildwatch_destroy();
+  prefetch_destroy();
+  triage_destroy();
+  buildlog_destroy();
+  writeback_destroy();
+  commit_destroy();
+  memcache_free();
+  zcache_free();
+  http_destroy();
+  log_destroy();
 }
 
 static void compile_regexes(void)
@@ -1339,6 +2269,11 @@ static void compile_regexes(void)
   regcomp(&build_project_repo_arch, "/build/[^/]*/[^/]*/[^/]*$", REG_EXTENDED);
   regcomp(&build_project_repo_arch_foo, "/build/[^/]*/[^/]*/[^/]*/[^/]*$", REG_EXTENDED);
   regcomp(&build_project_repo_arch_failed, "/build/([^/]*)/([^/]*)/([^/]*)/" NODE_FAILED, REG_EXTENDED);
+  regcomp(&build_project_repo_arch_package, "^/build/([^/_][^/]*)/([^/]*)/([^/]*)(/([^/]*))?$", REG_EXTENDED);
+  regcomp(&tree_dir, "^/(build/[^/_][^/]*(/[^/_][^/]*){0,3}|source/[^/_][^/]*(/[^/_][^/]*)?)$", REG_EXTENDED);
+  regcomp(&build_project_summary, "^/build/([^/_][^/]*)/(" NODE_SUMMARY "[^/]*)$", REG_EXTENDED);
+  regcomp(&build_project_repo_arch_package_status, "^/build/([^/_][^/]*)/([^/]*)/([^/]*)/([^/]*)/_status$", REG_EXTENDED);
+  regcomp(&build_project_repo_arch_package_tail, "^/build/([^/_][^/]*)/([^/]*)/([^/]*)/([^/]*)/" NODE_LOG_TAIL "$", REG_EXTENDED);
   regcomp(&source_project, "/source/([^/]*)$", REG_EXTENDED);
   regcomp(&source_project_package, "/source/([^/]*)/([^/]*)$", REG_EXTENDED);
   regcomp(&source_project_package_rev, "(/source/[^/]*/[^/]*)/_rev$", REG_EXTENDED);
@@ -1356,6 +2291,11 @@ static void free_regexes(void)
   regfree(&build_project_repo_arch);
   regfree(&build_project_repo_arch_foo);
   regfree(&build_project_repo_arch_failed);
+  regfree(&build_project_repo_arch_package);
+  regfree(&build_project_repo_arch_package_status);
+  regfree(&build_project_repo_arch_package_tail);
+  regfree(&build_project_summary);
+  regfree(&tree_dir);
   regfree(&source_project);
   regfree(&source_project_package);
   regfree(&source_project_package_rev);
@@ -1371,7 +2311,9 @@ static struct fuse_operations obsfs_oper = {
   .readdir = obsfs_readdir,
   .open = obsfs_open,
   .flush = obsfs_flush,
+  .fsync = obsfs_fsync,
   .release = obsfs_release,
+  .poll = obsfs_poll,
   .truncate = obsfs_truncate,
   .create = obsfs_create,
   .read = obsfs_read,
@@ -1398,8 +2340,43 @@ static int obsfs_opt_proc(void *data, const char *arg, int key, struct fuse_args
         "    -o host=STRING         OBS server name (" DEFAULT_HOST ")\n"
         "    -o user=STRING         OBS user name (from .oscrc)\n"
         "    -o pass=STRING         OBS password (from .oscrc)\n"
+        "    -o commit_delay=N      commit changes to a package in one batch\n"
+        "                           N seconds after the last one (0, disabled)\n"
+        "    -o writeback_threads=N upload modified files in the background\n"
+        "                           using N threads, 0 uploads on close (%d)\n"
+        "    -o upload_rate=N       limit uploads to N KB/s (unlimited)\n"
+        "    -o memcache=N          keep up to N KB of small files in memory,\n"
+        "                           0 disables (%d)\n"
+        "    -o memcache_file=N     largest file kept in memory in KB (%d)\n"
+        "    -o prefetch_info       get source info for whole projects at once\n"
+        "    -o bulk_build          get build results and binaries for whole\n"
+        "                           projects at once\n"
+        "    -o log_tail=N          size of _log.tail files in KB (%d)\n"
+        "    -o nocompress          don't compress cached text files\n"
+        "    -o prefetch_threads=N  retrieve directories we are likely to need\n"
+        "                           soon using N threads, 0 disables (%d)\n"
+        "    -o prefetch_files=LIST package files to prefetch when a package is\n"
+        "                           listed, colon-separated patterns\n"
+        "                           (" PREFETCH_FILES ")\n"
+        "    -o prefetch_size=N     largest file to prefetch in KB (%d)\n"
+        "    -o triage=log|tail     retrieve all logs or log tails in a _failed\n"
+        "                           directory when it is listed (disabled)\n"
+        "    -o triage_conns=N      retrieve up to N logs at a time (%d)\n"
+        "    -o triage_budget=N     retrieve up to N MB per _failed directory (%d)\n"
+        "    -o changes=N           look for changed sources on the server every\n"
+        "                           N seconds and keep source listings longer\n"
+        "                           (0, disabled)\n"
+        "    -o build_watch         have the server tell us when build results\n"
+        "                           change and keep /build listings until then\n"
+        "    -o dir_ttl_min=N       keep directory listings that change often\n"
+        "                           for at least N seconds (%d)\n"
+        "    -o dir_ttl_max=N       keep listings that don't change for up to\n"
+        "                           N seconds (%d)\n"
+        "    -o log=SPEC            what to log, a level for all subsystems or\n"
+        "                           subsystem=level, comma-separated (" LOG_DEFAULT ")\n"
         "\n"
-        , outargs->argv[0]);
+        , outargs->argv[0], WRITEBACK_THREADS, MEMCACHE_SIZE, MEMCACHE_FILE, LOG_TAIL_SIZE, PREFETCH_THREADS,
+        PREFETCH_SIZE, TRIAGE_CONNS, TRIAGE_BUDGET, DIR_TTL_MIN, DIR_TTL_MAX);
       fuse_opt_add_arg(outargs, "-ho");
       fuse_main(outargs->argc, outargs->argv, &obsfs_oper, NULL);
       exit(1);
@@ -1432,9 +2409,37 @@ int main(int argc, char *argv[])
   args.argv[args.argc] = NULL;
   
   memset(&options, 0, sizeof(struct options));
+  options.writeback_threads = WRITEBACK_THREADS;
+  options.memcache_size = MEMCACHE_SIZE;
+  options.memcache_file = MEMCACHE_FILE;
+  options.log_tail = LOG_TAIL_SIZE;
+  options.prefetch_threads = PREFETCH_THREADS;
+  options.prefetch_files = PREFETCH_FILES;
+  options.prefetch_size = PREFETCH_SIZE;
+  options.triage_conns = TRIAGE_CONNS;
+  options.triage_budget = TRIAGE_BUDGET;
+  options.dir_ttl_min = DIR_TTL_MIN;
+  options.dir_ttl_max = DIR_TTL_MAX;
+  options.log = LOG_DEFAULT;
   if (fuse_opt_parse(&args, &options, obsfs_opts, obsfs_opt_proc) == -1)
     return -1;
 
+  if (options.triage && strcmp(options.triage, "log") && strcmp(options.triage, "tail")) {
+    fprintf(stderr, "triage must be \"log\" or \"tail\"\n");
+    return -1;
+  }
+  /* the logs are retrieved by the prefetch threads, which always keep one
+     of them free for other requests */
+  if (options.triage && options.prefetch_threads < 2) {
+    fprintf(stderr, "triage needs prefetch_threads to be at least 2\n");
+    return -1;
+  }
+
+  if (log_set(options.log)) {
+    fprintf(stderr, "invalid log setting \"%s\"\n", options.log);
+    return -1;
+  }
+
   if (!options.api_username || !options.api_password) {
     /* No credentials given, so we try to read them from the .oscrc file. */
     if (rc_get_account(options.api_hostname ? : DEFAULT_HOST, home, oscrc,
@@ -1452,6 +2457,8 @@ int main(int argc, char *argv[])
   /* initialize caches */
   attr_cache_init();
   dir_cache_init();
+  dir_cache_set_ttl(options.dir_ttl_min, options.dir_ttl_max);
+  prjinfo_init();
   
   /* create a directory for the file cache */
   file_cache_dir = strdup("/tmp/obsfs_cacheXXXXXX");
@@ -1463,11 +2470,14 @@ int main(int argc, char *argv[])
      mount point specified; will do it in obsfs_init() */
 
   compile_regexes();
+  if (*options.prefetch_files)
+    prefetch_patterns = g_strsplit(options.prefetch_files, ":", -1);
   
   /* Go! */
   ret = fuse_main(args.argc, args.argv, &obsfs_oper, NULL);
   
   free_regexes();
+  g_strfreev(prefetch_patterns);
   
   /* remove the file cache */
   if (!chdir(file_cache_dir)) {
@@ -1481,6 +2491,8 @@ int main(int argc, char *argv[])
   fuse_opt_free_args(&args);
   attr_cache_free();
   dir_cache_free();
+  prjinfo_free();
+  buildinfo_free();
   
   curl_global_cleanup();
   
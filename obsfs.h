@@ -28,10 +28,86 @@
    timeout for the attribute cache, which reduces server load. */
 
 #define DIR_CACHE_TIMEOUT 20
+/* bounds for directory timeouts adapted to how often a listing changes */
+#define DIR_TTL_MIN 10
+#define DIR_TTL_MAX 600
+/* number of directories whose learned timeouts are remembered */
+#define DIR_TTL_HISTORY 4096
 #define ATTR_CACHE_TIMEOUT 3600
 #define FILE_CACHE_TIMEOUT 600
+#define LOG_REFRESH_INTERVAL 1	/* seconds between requests for more of an open build log */
+
+/* Editors and "cp" tend to close a file several times in quick succession,
+   so uploads are held back for a moment in case another flush follows. */
+#define WRITEBACK_DELAY 1
+#define WRITEBACK_THREADS 2
+/* how long we trust our record of what we last uploaded to a file; after
+   that, flushing it uploads it again even if it hasn't changed */
+#define UPLOADED_TIMEOUT 300
+
+#define PREFETCH_THREADS 4
+
+/* a walk through a directory's subdirectories is considered sequential
+   after this many visits in listing order; we then stay up to
+   READAHEAD_WINDOW subdirectories ahead of it */
+#define READAHEAD_MIN_RUN 2
+#define READAHEAD_WINDOW 8
+/* number of directories whose walks we keep track of */
+#define READAHEAD_WALKS 256
+
+/* package files that are prefetched when the package is listed, and their
+   maximum size in KB */
+#define PREFETCH_FILES "*.spec:_meta:_link:_service"
+#define PREFETCH_SIZE 64
+
+/* failed-build triage: logs retrieved at the same time, and MB retrieved
+   per _failed directory */
+#define TRIAGE_CONNS 4
+#define TRIAGE_BUDGET 256
+
+/* change feed: entries requested per poll, and the timeout of source
+   listings while we are watching it */
+#define CHANGES_LIMIT 100
+#define CHANGES_SOURCE_TIMEOUT 600
+
+/* build result watcher: projects watched at most, seconds a project may go
+   unused before we stop watching it, and seconds to wait after an error */
+#define BUILDWATCH_MAX 8
+#define BUILDWATCH_IDLE 600
+#define BUILDWATCH_RETRY 10
+
+/* in-memory cache for small files, sizes in KB */
+#define MEMCACHE_SIZE 16384
+#define MEMCACHE_FILE 64
+
+/* compressed file cache; the frame size is in uncompressed bytes */
+#define ZCACHE_FRAME_SIZE (128 * 1024)
+#define ZCACHE_LEVEL 3
+
+/* uploads */
+#define UPLOAD_BUFFER_SIZE (2 * 1024 * 1024)	/* libcurl's maximum */
+#define UPLOAD_RETRIES 3
+#define UPLOAD_STALL_TIMEOUT 60	/* seconds without progress before we retry */
 
 #define DEFAULT_HOST "api.opensuse.org"
 
+/* cookies are kept in memory and written to the jar in the file cache
+   directory this often (in seconds), and at unmount */
+#define COOKIE_JAR "cookies"
+#define COOKIE_SAVE_INTERVAL 300
+
 #define NODE_UNEXPANDED "_unexpanded"
 #define NODE_FAILED "_failed"
+#define NODE_SUMMARY "_summary"
+#define NODE_LOG_TAIL "_log.tail"
+#define LOG_TAIL_SIZE 64	/* KB of a build log in _log.tail */
+#define LOG_TAIL_TIMEOUT 10	/* seconds the tail of a running build is cached */
+#define NODE_CONTROL "/_obsfs"	/* obsfs' own status files */
+
+/* logging: default levels (see log_set()), lines kept per thread until they
+   are written out, their maximum length, and how often they are written out
+   (in ms) */
+#define LOG_DEFAULT "warn"
+#define LOG_RING_SIZE 128
+#define LOG_LINE_MAX 256
+#define LOG_FLUSH_INTERVAL 100
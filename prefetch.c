@@ -0,0 +1,294 @@
+/*
+ * prefetch.c
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "prefetch.h"
+#include "obsfs.h"
+#include "cache.h"
+#include "util.h"
+#include "uthash.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define DEBUG_PREFETCH
+
+#ifdef DEBUG_PREFETCH
+#define DEBUG(x...) LOG(LOG_BG, LEVEL_DEBUG, x)
+#else
+#define DEBUG(x...)
+#endif
+
+enum {
+  JOB_QUEUED,
+  JOB_RUNNING
+};
+
+typedef struct {
+  char *path;
+  prefetch_fn fn;
+  int state;
+  int priority;
+  UT_hash_handle hh;
+} job_t;
+
+/* how a directory's subdirectories are being visited */
+typedef struct {
+  char *path;
+  int last;		/* index of the subdirectory visited last */
+  int run;		/* number of visits in a row in listing order */
+  int ahead;		/* subdirectories before this one have been queued */
+  UT_hash_handle hh;
+} walk_t;
+
+/* queued and running jobs, in the order they were queued */
+static job_t *job_hash = NULL;
+static pthread_mutex_t pf_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pf_work_cond = PTHREAD_COND_INITIALIZER;	/* new work for the workers */
+static pthread_cond_t pf_done_cond = PTHREAD_COND_INITIALIZER;	/* a job has finished */
+static pthread_t *workers = NULL;
+static unsigned int num_workers = 0;
+static int pf_stop = 0;
+static unsigned int low_running = 0;	/* low-priority jobs being worked on */
+
+static walk_t *walk_hash = NULL;
+static pthread_mutex_t walk_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_job(job_t *j)
+{
+  free(j->path);
+  free(j);
+}
+
+/* pick the next job, high-priority ones first; low-priority jobs never get
+   all the workers, so there is always one left for the others (and with a
+   single worker, prefetch_queue() doesn't take any); pf_mutex must be
+   held */
+static job_t *next_job(void)
+{
+  job_t *j, *tmp, *low = NULL;
+  HASH_ITER(hh, job_hash, j, tmp) {
+    if (j->state != JOB_QUEUED)
+      continue;
+    if (j->priority == PREFETCH_HIGH)
+      return j;
+    if (!low)
+      low = j;
+  }
+  if (low && low_running < num_workers - 1)
+    return low;
+  return NULL;
+}
+
+static void *prefetch_worker(void *arg)
+{
+  job_t *j;
+  pthread_mutex_lock(&pf_mutex);
+  for (;;) {
+    while (!pf_stop && !(j = next_job()))
+      pthread_cond_wait(&pf_work_cond, &pf_mutex);
+    if (pf_stop)
+      break;
+    j->state = JOB_RUNNING;
+    if (j->priority == PREFETCH_LOW)
+      low_running++;
+    pthread_mutex_unlock(&pf_mutex);
+    
+    DEBUG("PREFETCH: getting %s\n", j->path);
+    j->fn(j->path);
+    
+    pthread_mutex_lock(&pf_mutex);
+    if (j->priority == PREFETCH_LOW)
+      low_running--;
+    HASH_DEL(job_hash, j);
+    free_job(j);
+    pthread_cond_broadcast(&pf_done_cond);
+    /* a low-priority job may have been held back */
+    pthread_cond_signal(&pf_work_cond);
+  }
+  pthread_mutex_unlock(&pf_mutex);
+  return NULL;
+}
+
+void prefetch_init(unsigned int threads)
+{
+  unsigned int i;
+  num_workers = threads;
+  if (!num_workers)
+    return;
+  workers = calloc(num_workers, sizeof(pthread_t));
+  for (i = 0; i < num_workers; i++) {
+    if (pthread_create(&workers[i], NULL, prefetch_worker, NULL)) {
+      perror("pthread_create");
+      abort();
+    }
+  }
+}
+
+/* stop the workers; whatever is still queued is dropped */
+void prefetch_destroy(void)
+{
+  unsigned int i;
+  job_t *j, *tmp;
+  
+  if (!num_workers)
+    return;
+  
+  pthread_mutex_lock(&pf_mutex);
+  pf_stop = 1;
+  pthread_cond_broadcast(&pf_work_cond);
+  pthread_mutex_unlock(&pf_mutex);
+  for (i = 0; i < num_workers; i++)
+    pthread_join(workers[i], NULL);
+  free(workers);
+  num_workers = 0;
+  
+  HASH_ITER(hh, job_hash, j, tmp) {
+    HASH_DEL(job_hash, j);
+    free_job(j);
+  }
+  
+  walk_t *w, *wtmp;
+  pthread_mutex_lock(&walk_mutex);
+  HASH_ITER(hh, walk_hash, w, wtmp) {
+    HASH_DEL(walk_hash, w);
+    free(w->path);
+    free(w);
+  }
+  pthread_mutex_unlock(&walk_mutex);
+}
+
+/* have "fn" called for "path" in the background; returns -1 if prefetching
+   is disabled (for low-priority jobs, if there aren't at least two workers)
+   or "path" is already queued */
+int prefetch_queue(const char *path, prefetch_fn fn, int priority)
+{
+  job_t *j;
+  if (!num_workers || (priority == PREFETCH_LOW && num_workers < 2))
+    return -1;
+  pthread_mutex_lock(&pf_mutex);
+  HASH_FIND_STR(job_hash, path, j);
+  if (j) {
+    /* somebody may be waiting for it now */
+    if (priority > j->priority && j->state == JOB_QUEUED)
+      j->priority = priority;
+    pthread_mutex_unlock(&pf_mutex);
+    return -1;
+  }
+  j = calloc(1, sizeof(job_t));
+  j->path = strdup(path);
+  j->fn = fn;
+  j->state = JOB_QUEUED;
+  j->priority = priority;
+  HASH_ADD_KEYPTR(hh, job_hash, j->path, strlen(j->path), j);
+  pthread_cond_signal(&pf_work_cond);
+  pthread_mutex_unlock(&pf_mutex);
+  return 0;
+}
+
+/* somebody needs "path" now: if it is being prefetched, wait for it; if it
+   is only queued, run the job right here, so that whatever it does
+   afterwards (such as starting the next job of a series) still happens */
+void prefetch_wait(const char *path)
+{
+  job_t *j;
+  if (!num_workers)
+    return;
+  pthread_mutex_lock(&pf_mutex);
+  for (;;) {
+    HASH_FIND_STR(job_hash, path, j);
+    if (!j)
+      break;
+    if (j->state == JOB_QUEUED) {
+      j->state = JOB_RUNNING;
+      pthread_mutex_unlock(&pf_mutex);
+      DEBUG("PREFETCH: getting %s in the foreground\n", j->path);
+      j->fn(j->path);
+      pthread_mutex_lock(&pf_mutex);
+      HASH_DEL(job_hash, j);
+      free_job(j);
+      pthread_cond_broadcast(&pf_done_cond);
+      break;
+    }
+    pthread_cond_wait(&pf_done_cond, &pf_mutex);
+  }
+  pthread_mutex_unlock(&pf_mutex);
+}
+
+/* Recursive walkers (find, du, ls -R) visit the subdirectories of a
+   directory one after the other, in listing order.  When we see that
+   happening, we queue the next few subdirectories for prefetching, so the
+   walker finds them ready.  "path" is the directory being read. */
+void prefetch_readahead(const char *path, prefetch_fn fn)
+{
+  const char *name;
+  char parent[PATH_MAX], sub_path[PATH_MAX];
+  walk_t *w;
+  int index, i;
+  
+  if (num_workers < 2 || dirname_buf(path, parent, sizeof(parent), &name))
+    return;
+  index = dir_cache_subdir_index(parent, name);
+  if (index < 0)
+    return;
+  
+  pthread_mutex_lock(&walk_mutex);
+  HASH_FIND_STR(walk_hash, parent, w);
+  if (w) {
+    /* move to the end, so the head is the walk we saw least recently */
+    HASH_DEL(walk_hash, w);
+  }
+  else {
+    if (HASH_COUNT(walk_hash) >= READAHEAD_WALKS) {
+      walk_t *old = walk_hash;
+      HASH_DEL(walk_hash, old);
+      free(old->path);
+      free(old);
+    }
+    w = calloc(1, sizeof(walk_t));
+    w->path = strdup(parent);
+    w->last = -1;
+  }
+  HASH_ADD_KEYPTR(hh, walk_hash, w->path, strlen(w->path), w);
+  if (index == w->last + 1)
+    w->run++;
+  else {
+    w->run = 0;
+    w->ahead = index + 1;
+  }
+  w->last = index;
+  if (w->ahead <= index)
+    w->ahead = index + 1;
+  
+  if (w->run >= READAHEAD_MIN_RUN) {
+    for (i = w->ahead; i <= index + READAHEAD_WINDOW; i++) {
+      char *sub = dir_cache_subdir(parent, i);
+      if (!sub)
+        break;
+      if (!path_join(sub_path, sizeof(sub_path), parent, sub) && !dir_cache_fresh(sub_path))
+        prefetch_queue(sub_path, fn, PREFETCH_LOW);
+      free(sub);
+    }
+    w->ahead = i;
+  }
+  pthread_mutex_unlock(&walk_mutex);
+}
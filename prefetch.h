@@ -0,0 +1,40 @@
+/*
+ * prefetch.h
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* background prefetching
+   A small pool of worker threads retrieves things we expect to be asked for
+   soon.  Each job is identified by the FUSE path it fills in, so a request
+   for something that is already being prefetched waits for it instead of
+   retrieving it a second time. */
+
+typedef void (*prefetch_fn)(const char *path);
+
+/* job priorities; something somebody is likely to wait for comes before
+   mere speculation */
+enum {
+  PREFETCH_LOW,
+  PREFETCH_HIGH
+};
+
+void prefetch_init(unsigned int threads);
+void prefetch_destroy(void);
+int prefetch_queue(const char *path, prefetch_fn fn, int priority);
+void prefetch_wait(const char *path);
+void prefetch_readahead(const char *path, prefetch_fn fn);
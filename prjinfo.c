@@ -0,0 +1,221 @@
+/*
+ * prjinfo.c
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "prjinfo.h"
+#include "obsfs.h"
+#include "util.h"
+#include "http.h"
+#include "uthash.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <expat.h>
+
+#define DEBUG_PRJINFO
+
+#ifdef DEBUG_PRJINFO
+#define DEBUG(x...) LOG(LOG_XML, LEVEL_DEBUG, x)
+#else
+#define DEBUG(x...)
+#endif
+
+/* info about one package */
+typedef struct {
+  char *package;
+  char srcmd5[MD5_HEX_LEN + 1];	/* expanded sources */
+  UT_hash_handle hh;
+} pkginfo_t;
+
+/* info about all packages of a project */
+typedef struct {
+  char *project;
+  pkginfo_t *packages;
+  time_t timestamp;
+  int fetching;		/* a request is under way */
+  UT_hash_handle hh;
+} prjinfo_t;
+
+static prjinfo_t *prjinfo_hash = NULL;
+static pthread_mutex_t prjinfo_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prjinfo_cond = PTHREAD_COND_INITIALIZER;
+
+void prjinfo_init(void)
+{
+  prjinfo_hash = NULL;
+}
+
+static void free_packages(pkginfo_t **packages)
+{
+  pkginfo_t *p, *tmp;
+  HASH_ITER(hh, *packages, p, tmp) {
+    HASH_DEL(*packages, p);
+    free(p->package);
+    free(p);
+  }
+}
+
+void prjinfo_free(void)
+{
+  prjinfo_t *pi, *tmp;
+  pthread_mutex_lock(&prjinfo_mutex);
+  HASH_ITER(hh, prjinfo_hash, pi, tmp) {
+    HASH_DEL(prjinfo_hash, pi);
+    free_packages(&pi->packages);
+    free(pi->project);
+    free(pi);
+  }
+  pthread_mutex_unlock(&prjinfo_mutex);
+}
+
+/* expat tag start handler for <sourceinfolist> */
+static void expat_info_start(void *ud, const XML_Char *name, const XML_Char **atts)
+{
+  pkginfo_t **packages = (pkginfo_t **)ud;
+  const char *package = NULL, *srcmd5 = NULL;
+  pkginfo_t *p;
+  
+  if (strcmp(name, "sourceinfo"))
+    return;
+  for (; *atts; atts += 2) {
+    if (!strcmp(atts[0], "package"))
+      package = atts[1];
+    else if (!strcmp(atts[0], "srcmd5"))
+      srcmd5 = atts[1];
+  }
+  if (!package || !srcmd5 || strlen(srcmd5) != MD5_HEX_LEN)
+    return;
+  p = calloc(1, sizeof(pkginfo_t));
+  p->package = strdup(package);
+  strcpy(p->srcmd5, srcmd5);
+  HASH_ADD_KEYPTR(hh, *packages, p->package, strlen(p->package), p);
+}
+
+static size_t info_write(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+  XML_Parse((XML_Parser)userdata, ptr, size * nmemb, 0);
+  return size * nmemb;
+}
+
+/* get source info for all packages of "project", unless we have recent
+   info already; returns 0 on success */
+int prjinfo_fetch(const char *project)
+{
+  prjinfo_t *pi;
+  pkginfo_t *packages = NULL;
+  int ret;
+  
+  pthread_mutex_lock(&prjinfo_mutex);
+  HASH_FIND_STR(prjinfo_hash, project, pi);
+  if (!pi) {
+    pi = calloc(1, sizeof(prjinfo_t));
+    pi->project = strdup(project);
+    HASH_ADD_KEYPTR(hh, prjinfo_hash, pi->project, strlen(pi->project), pi);
+  }
+  /* somebody else is asking the server already */
+  while (pi->fetching)
+    pthread_cond_wait(&prjinfo_cond, &prjinfo_mutex);
+  if (pi->timestamp && time(NULL) - pi->timestamp <= DIR_CACHE_TIMEOUT) {
+    pthread_mutex_unlock(&prjinfo_mutex);
+    return 0;
+  }
+  pi->fetching = 1;
+  pthread_mutex_unlock(&prjinfo_mutex);
+  
+  DEBUG("PRJINFO: getting source info for %s\n", project);
+  XML_Parser xp = XML_ParserCreate(NULL);
+  if (!xp)
+    abort();
+  XML_SetUserData(xp, (void *)&packages);
+  XML_SetElementHandler(xp, expat_info_start, NULL);
+  
+  char *path = malloc(strlen("/source/") + strlen(project) + strlen("?view=info") + 1);
+  sprintf(path, "/source/%s?view=info", project);
+  char *url = make_url(url_prefix, path, NULL);
+  free(path);
+  CURL *curl = curl_open_file(url, NULL, NULL, info_write, xp);
+  ret = http_perform(curl);
+  http_close(curl);
+  XML_ParserFree(xp);
+  free(url);
+  if (ret)
+    LOG(LOG_XML, LEVEL_ERROR, "PRJINFO: curl error %d\n", ret);
+  
+  pthread_mutex_lock(&prjinfo_mutex);
+  if (!ret) {
+    free_packages(&pi->packages);
+    pi->packages = packages;
+    pi->timestamp = time(NULL);
+  }
+  else
+    free_packages(&packages);
+  pi->fetching = 0;
+  pthread_cond_broadcast(&prjinfo_cond);
+  pthread_mutex_unlock(&prjinfo_mutex);
+  return ret ? -1 : 0;
+}
+
+/* look up the current srcmd5 of a package, asking the server for fresh
+   project info if necessary; returns 0 if found */
+int prjinfo_srcmd5(const char *project, const char *package, char *srcmd5)
+{
+  prjinfo_t *pi;
+  pkginfo_t *p = NULL;
+  
+  if (prjinfo_fetch(project))
+    return -1;
+  pthread_mutex_lock(&prjinfo_mutex);
+  HASH_FIND_STR(prjinfo_hash, project, pi);
+  if (pi)
+    HASH_FIND_STR(pi->packages, package, p);
+  if (p)
+    strcpy(srcmd5, p->srcmd5);
+  pthread_mutex_unlock(&prjinfo_mutex);
+  return p ? 0 : -1;
+}
+
+/* forget what we know about "project", its sources have changed */
+void prjinfo_invalidate(const char *project)
+{
+  prjinfo_t *pi;
+  pthread_mutex_lock(&prjinfo_mutex);
+  HASH_FIND_STR(prjinfo_hash, project, pi);
+  if (pi)
+    pi->timestamp = 0;
+  pthread_mutex_unlock(&prjinfo_mutex);
+}
+
+/* we have changed the sources at the API path "path" ourselves; what we
+   know about its project is out of date if it is below /source */
+void prjinfo_invalidate_path(const char *path)
+{
+  char project[NAME_MAX + 1];
+  const char *p, *end;
+  if (strncmp(path, "/source/", 8))
+    return;
+  p = path + 8;
+  if (!(end = strchr(p, '/')))
+    end = p + strlen(p);
+  if (view_cpy(project, sizeof(project), (strview_t){ p, end - p }))
+    prjinfo_invalidate(project);
+}
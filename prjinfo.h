@@ -0,0 +1,31 @@
+/*
+ * prjinfo.h
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* project-wide source info
+   One /source/<project>?view=info request tells us the current srcmd5 of
+   every package in a project, which is enough to tell if a cached package
+   listing is still up to date. */
+
+void prjinfo_init(void);
+void prjinfo_free(void);
+int prjinfo_fetch(const char *project);
+int prjinfo_srcmd5(const char *project, const char *package, char *srcmd5);
+void prjinfo_invalidate(const char *project);
+void prjinfo_invalidate_path(const char *path);
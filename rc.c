@@ -26,11 +26,12 @@
 #include <bzlib.h>
 
 #include "rc.h"
+#include "log.h"
 
 //#define DEBUG_RC
 
 #ifdef DEBUG_RC
-#define DEBUG(x...) fprintf(stderr, x)
+#define DEBUG(x...) LOG(LOG_HTTP, LEVEL_DEBUG, x)
 #else
 #define DEBUG(x...)
 #endif
@@ -0,0 +1,109 @@
+/*
+ * srcstore.c
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "srcstore.h"
+#include "util.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#define DEBUG_SRCSTORE
+
+#ifdef DEBUG_SRCSTORE
+#define DEBUG(x...) LOG(LOG_CACHE, LEVEL_DEBUG, x)
+#else
+#define DEBUG(x...)
+#endif
+
+/* name of the store file for "srcmd5"; "name" must have room for
+   sizeof(SRCSTORE_DIR) + MD5_HEX_LEN + 1 bytes.  Returns -1 if "srcmd5"
+   does not look like one, it comes from the server after all. */
+static int store_name(const char *srcmd5, char *name)
+{
+  int i;
+  for (i = 0; srcmd5[i]; i++) {
+    if (!isxdigit((unsigned char)srcmd5[i]))
+      return -1;
+  }
+  if (i != MD5_HEX_LEN)
+    return -1;
+  sprintf(name, SRCSTORE_DIR "/%s", srcmd5);
+  return 0;
+}
+
+/* get the listing for "srcmd5" into a buffer, to be free()d by the caller;
+   returns 0 if we have it */
+int srcstore_get(const char *srcmd5, char **data, size_t *len)
+{
+  char name[sizeof(SRCSTORE_DIR) + MD5_HEX_LEN + 1];
+  struct stat st;
+  int fd;
+  
+  if (store_name(srcmd5, name))
+    return -1;
+  fd = open(name, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st)) {
+    close(fd);
+    return -1;
+  }
+  *len = st.st_size;
+  *data = malloc(*len);
+  if (read(fd, *data, *len) != (ssize_t)*len) {
+    free(*data);
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  DEBUG("SRCSTORE: have listing for %s\n", srcmd5);
+  return 0;
+}
+
+/* remember the listing "data" for "srcmd5"; it is written to a temporary
+   file first, so that a listing in the store is always complete */
+void srcstore_put(const char *srcmd5, const char *data, size_t len)
+{
+  char name[sizeof(SRCSTORE_DIR) + MD5_HEX_LEN + 1];
+  char tmp[sizeof(name) + 16];
+  FILE *fp;
+  
+  if (store_name(srcmd5, name) || !access(name, F_OK))
+    return;
+  snprintf(tmp, sizeof(tmp), "%s.%lx", name, (unsigned long)pthread_self());
+  if (mkdirp(name, 0755) || !(fp = fopen(tmp, "w")))
+    return;
+  if (fwrite(data, 1, len, fp) != len) {
+    fclose(fp);
+    unlink(tmp);
+    return;
+  }
+  if (fclose(fp) || rename(tmp, name))
+    unlink(tmp);
+  else
+    DEBUG("SRCSTORE: storing listing for %s\n", srcmd5);
+}
@@ -0,0 +1,31 @@
+/*
+ * srcstore.h
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+
+/* expanded source listings by srcmd5
+   An expanded source listing is fully determined by the srcmd5 the server
+   reports for it, so once we have seen a listing, it never expires.  The
+   listings are kept as retrieved, in the file cache directory. */
+
+#define SRCSTORE_DIR "_listings"
+
+int srcstore_get(const char *srcmd5, char **data, size_t *len);
+void srcstore_put(const char *srcmd5, const char *data, size_t len);
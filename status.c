@@ -19,6 +19,7 @@
  */
 
 #include "status.h"
+#include "log.h"
 #include <stdlib.h>
 #include <expat.h>
 #include <stdio.h>
@@ -108,7 +109,7 @@ status_t *xml_status_init(void)
 int xml_status_write(void *ptr, size_t size, size_t nmemb, void *vst)
 {
   status_t *status = (status_t *)vst;
-  fwrite(ptr, size, nmemb, stderr);
+  LOG(LOG_XML, LEVEL_DEBUG, "STATUS: %.*s\n", (int)(size * nmemb), (char *)ptr);
   XML_Parse(status->xp, ptr, size * nmemb, 0);
   return size * nmemb;
 }
@@ -0,0 +1,187 @@
+/*
+ * triage.c
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "prefetch.h"
+#include "triage.h"
+#include "obsfs.h"
+#include "cache.h"
+#include "uthash.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define DEBUG_TRIAGE
+
+#ifdef DEBUG_TRIAGE
+#define DEBUG(x...) LOG(LOG_BG, LEVEL_DEBUG, x)
+#else
+#define DEBUG(x...)
+#endif
+
+/* the logs from one _failed listing share a byte budget */
+typedef struct {
+  off_t left;
+  int refs;
+} batch_t;
+
+typedef struct item_s {
+  char *path;
+  batch_t *batch;
+  struct item_s *next;
+  UT_hash_handle hh;
+} item_t;
+
+/* logs waiting to be retrieved, oldest listing first */
+static item_t *pending_head = NULL;
+static item_t *pending_tail = NULL;
+/* logs handed to the prefetch workers */
+static item_t *running_hash = NULL;
+static unsigned int running = 0;
+static pthread_mutex_t triage_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int max_conns = 0;
+static off_t budget = 0;
+static prefetch_fn fetch_fn = NULL;
+
+static void free_item(item_t *it)
+{
+  if (!--it->batch->refs)
+    free(it->batch);
+  free(it->path);
+  free(it);
+}
+
+static void triage_job(const char *path);
+
+/* hand as many pending logs to the prefetch workers as we may;
+   triage_mutex must be held */
+static void kick(void)
+{
+  item_t *it, *other;
+  while (running < max_conns && pending_head) {
+    it = pending_head;
+    pending_head = it->next;
+    if (!pending_head)
+      pending_tail = NULL;
+    if (it->batch->left <= 0) {
+      DEBUG("TRIAGE: budget exhausted, skipping %s\n", it->path);
+      free_item(it);
+      continue;
+    }
+    HASH_FIND_STR(running_hash, it->path, other);
+    if (other) {
+      free_item(it);
+      continue;
+    }
+    HASH_ADD_KEYPTR(hh, running_hash, it->path, strlen(it->path), it);
+    running++;
+    if (prefetch_queue(it->path, triage_job, PREFETCH_LOW)) {
+      HASH_DEL(running_hash, it);
+      running--;
+      free_item(it);
+    }
+  }
+}
+
+/* prefetch job: retrieve a log, charge its size to the budget of the
+   listing it came from, and go on with the next one */
+static void triage_job(const char *path)
+{
+  item_t *it;
+  attr_t *at;
+  off_t size = 0;
+  
+  fetch_fn(path);
+  at = attr_cache_find(path);
+  if (at)
+    size = at->st.st_size;
+  attr_cache_put(at);
+  DEBUG("TRIAGE: got %s, %lld bytes\n", path, (long long)size);
+  
+  pthread_mutex_lock(&triage_mutex);
+  HASH_FIND_STR(running_hash, path, it);
+  if (it) {
+    it->batch->left -= size;
+    HASH_DEL(running_hash, it);
+    running--;
+    free_item(it);
+  }
+  kick();
+  pthread_mutex_unlock(&triage_mutex);
+}
+
+/* "conns" is the number of logs retrieved at the same time, "budget" the
+   number of MB retrieved per listing; "fetch" gets a file into the cache */
+void triage_init(unsigned int conns, unsigned int budget_mb, prefetch_fn fetch)
+{
+  max_conns = conns;
+  budget = (off_t)budget_mb * 1024 * 1024;
+  fetch_fn = fetch;
+}
+
+/* drop whatever has not been retrieved yet; the prefetch workers must have
+   been stopped already */
+void triage_destroy(void)
+{
+  item_t *it, *tmp;
+  pthread_mutex_lock(&triage_mutex);
+  while ((it = pending_head)) {
+    pending_head = it->next;
+    free_item(it);
+  }
+  pending_tail = NULL;
+  HASH_ITER(hh, running_hash, it, tmp) {
+    HASH_DEL(running_hash, it);
+    free_item(it);
+  }
+  running = 0;
+  pthread_mutex_unlock(&triage_mutex);
+}
+
+/* retrieve the files at "paths", the logs listed in a _failed directory */
+void triage_start(char **paths, int num)
+{
+  int i;
+  batch_t *b;
+  item_t *it;
+  
+  if (!max_conns || !num)
+    return;
+  b = calloc(1, sizeof(batch_t));
+  b->left = budget;
+  b->refs = num;
+  pthread_mutex_lock(&triage_mutex);
+  for (i = 0; i < num; i++) {
+    it = calloc(1, sizeof(item_t));
+    it->path = strdup(paths[i]);
+    it->batch = b;
+    if (pending_tail)
+      pending_tail->next = it;
+    else
+      pending_head = it;
+    pending_tail = it;
+  }
+  DEBUG("TRIAGE: %d logs queued\n", num);
+  kick();
+  pthread_mutex_unlock(&triage_mutex);
+}
@@ -0,0 +1,29 @@
+/*
+ * triage.h
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* failed-build triage
+   Listing a _failed directory is nearly always followed by reading every
+   log in it.  Triage retrieves the logs listed there in the background, a
+   few at a time and no more than a fixed number of bytes per listing, so
+   they are local by the time they are read. */
+
+void triage_init(unsigned int conns, unsigned int budget, prefetch_fn fetch);
+void triage_destroy(void);
+void triage_start(char **paths, int num);
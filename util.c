@@ -19,6 +19,7 @@
  */
 
 #include "util.h"
+#include "log.h"
 
 #include <sys/stat.h>
 #include <errno.h>
@@ -27,11 +28,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <curl/curl.h>
 
 int mkdirp(const char *pathname, mode_t mode)
 {
   char *dname = dirname(strdup(pathname));
-  fprintf(stderr, "MKDIRP trying to create directory %s\n", dname);
+  LOG(LOG_CACHE, LEVEL_DEBUG, "MKDIRP trying to create directory %s\n", dname);
   if (mkdir(dname, mode)) {
     if (errno == EEXIST) {
       free(dname);
@@ -55,28 +59,59 @@ error:
   return -1;
 }
 
-char *dirname_c(const char *path, char **basenm)
+/* write the directory part of "path" to "buf", like dirname(3); "basenm"
+   points to the last component in "path"; returns -1 if it doesn't fit */
+int dirname_buf(const char *path, char *buf, size_t size, const char **basenm)
 {
-  char *p = strdup(path);
+  const char *slash = strrchr(path, '/');
+  size_t len;
   if (basenm)
-    *basenm = basename(p);
-  return dirname(p);
+    *basenm = slash ? slash + 1 : path;
+  if (!slash) {
+    path = ".";
+    len = 1;
+  }
+  else
+    len = slash == path ? 1 : slash - path;	/* keep the root's slash */
+  if (len >= size)
+    return -1;
+  memcpy(buf, path, len);
+  buf[len] = 0;
+  return 0;
+}
+
+/* write the path of "name" in the directory "dir" to "buf"; returns -1 if
+   it doesn't fit */
+int path_join(char *buf, size_t size, const char *dir, const char *name)
+{
+  int len = snprintf(buf, size, "%s/%s", strcmp(dir, "/") ? dir : "", name);
+  return len < 0 || (size_t)len >= size ? -1 : 0;
 }
 
 char *make_url(const char *url_prefix, const char *path, const char *rev)
 {
-  char *urlbuf = malloc(strlen(url_prefix) + strlen(path) + strlen("?rev=") + 32 + 1);
+  char *urlbuf = malloc(strlen(url_prefix) + strlen(path) + (rev ? strlen("?rev=") + strlen(rev) : 0) + 1);
   sprintf(urlbuf, "%s%s%s%s", url_prefix, path, rev? "?rev=" : "", rev? : "");
   return urlbuf;
 }
 
-char *get_match(regmatch_t match, const char *str)
+/* the part of "str" a subexpression has matched, without copying it */
+strview_t match_view(regmatch_t match, const char *str)
 {
-  int len = match.rm_eo - match.rm_so;
-  char *p = malloc(len + 1);
-  memcpy(p, str + match.rm_so, len);
-  p[len] = 0;
-  return p;
+  strview_t v;
+  v.ptr = str + match.rm_so;
+  v.len = match.rm_eo - match.rm_so;
+  return v;
+}
+
+/* copy a view to "buf" as a string; returns NULL if it doesn't fit */
+char *view_cpy(char *buf, size_t size, strview_t v)
+{
+  if ((size_t)v.len >= size)
+    return NULL;
+  memcpy(buf, v.ptr, v.len);
+  buf[v.len] = 0;
+  return buf;
 }
 
 int endswith(const char *str, const char *end)
@@ -167,7 +202,7 @@ int is_a_file(const char *path, const char *filename)
 size_t string_read(char *ptr, size_t size, size_t nmemb, string_read_t *str)
 {
   int send;
-  fprintf(stderr, "string_read %zd members of size %zd wanted\n", nmemb, size);
+  LOG(LOG_HTTP, LEVEL_DEBUG, "string_read %zd members of size %zd wanted\n", nmemb, size);
   if (str->pos >= str->len)
     send = 0;
   else {
@@ -175,6 +210,51 @@ size_t string_read(char *ptr, size_t size, size_t nmemb, string_read_t *str)
     memcpy(ptr, str->string + str->pos, send);
     str->pos += send;
   }
-  fprintf(stderr, "string_read returned %d bytes\n", send);
+  LOG(LOG_HTTP, LEVEL_DEBUG, "string_read returned %d bytes\n", send);
   return send / size;
 }
+
+/* rewind a string_read_t; libcurl needs this to resend a request body */
+int string_seek(string_read_t *str, off_t offset, int origin)
+{
+  if (origin != SEEK_SET || offset > str->len)
+    return CURL_SEEKFUNC_CANTSEEK;
+  str->pos = offset;
+  return CURL_SEEKFUNC_OK;
+}
+
+/* compute the hex MD5 sum of the file "filename" and store it in "md5",
+   which must have room for MD5_HEX_LEN + 1 characters */
+int md5_file(const char *filename, char *md5)
+{
+  char buf[65536];
+  ssize_t len;
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  GChecksum *cs = g_checksum_new(G_CHECKSUM_MD5);
+  while ((len = read(fd, buf, sizeof(buf))) > 0)
+    g_checksum_update(cs, (guchar *)buf, len);
+  close(fd);
+  if (len < 0) {
+    g_checksum_free(cs);
+    return -1;
+  }
+  strcpy(md5, g_checksum_get_string(cs));
+  g_checksum_free(cs);
+  return 0;
+}
+
+/* write a string to "fp", escaping the XML special characters */
+void xml_escape(FILE *fp, const char *str)
+{
+  for (; *str; str++) {
+    switch (*str) {
+      case '<': fputs("&lt;", fp); break;
+      case '>': fputs("&gt;", fp); break;
+      case '&': fputs("&amp;", fp); break;
+      case '"': fputs("&quot;", fp); break;
+      default: fputc(*str, fp); break;
+    }
+  }
+}
@@ -21,12 +21,30 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <regex.h>
+#include <limits.h>
+#include <stdio.h>
+
+/* Paths and API queries that only live as long as a request are put
+   together in buffers of this size on the stack; the queries are a path
+   plus some parameters. */
+#define API_PATH_MAX (PATH_MAX + 256)
+
+/* a piece of a longer string, not null-terminated; print it with "%.*s"
+   and VIEW_ARGS() */
+typedef struct {
+  const char *ptr;
+  int len;
+} strview_t;
+
+#define VIEW_ARGS(v) (v).len, (v).ptr
 
 int mkdirp(const char *pathname, mode_t mode);
-char *dirname_c(const char *path, char **basenm);
+int dirname_buf(const char *path, char *buf, size_t size, const char **basenm);
+int path_join(char *buf, size_t size, const char *dir, const char *name);
 char *make_url(const char *url_prefix, const char *path, const char *rev);
 
-char *get_match(regmatch_t match, const char *str);
+strview_t match_view(regmatch_t match, const char *str);
+char *view_cpy(char *buf, size_t size, strview_t v);
 
 int is_a_file(const char *path, const char *filename);
 int endswith(const char *str, const char *end);
@@ -45,3 +63,9 @@ typedef struct {
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 size_t string_read(char *ptr, size_t size, size_t nmemb, string_read_t *stream);
+int string_seek(string_read_t *stream, off_t offset, int origin);
+
+#define MD5_HEX_LEN 32
+int md5_file(const char *filename, char *md5);
+
+void xml_escape(FILE *fp, const char *str);
@@ -0,0 +1,582 @@
+/*
+ * writeback.c
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "writeback.h"
+#include "obsfs.h"
+#include "cache.h"
+#include "util.h"
+#include "status.h"
+#include "http.h"
+#include "prjinfo.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define DEBUG_WRITEBACK
+
+#ifdef DEBUG_WRITEBACK
+#define DEBUG(x...) LOG(LOG_HTTP, LEVEL_DEBUG, x)
+#else
+#define DEBUG(x...)
+#endif
+
+enum {
+  JOB_QUEUED,
+  JOB_RUNNING,
+  JOB_FAILED
+};
+
+/* one file waiting to be uploaded, or the result of a failed upload */
+typedef struct {
+  char *fs_path;	/* FUSE path, also the name of the local copy */
+  char *api_path;	/* where to PUT it */
+  int state;
+  int requeued;		/* flushed again while the upload was running */
+  time_t not_before;	/* debounce repeated flushes */
+  int error;		/* errno of the last failed upload */
+  UT_hash_handle hh;
+} job_t;
+
+/* MD5 sum of the content last uploaded for a path */
+typedef struct {
+  char *fs_path;
+  char md5[MD5_HEX_LEN + 1];
+  time_t time;		/* when it was uploaded */
+  UT_hash_handle hh;
+} uploaded_t;
+
+static job_t *job_hash = NULL;
+static uploaded_t *uploaded_hash = NULL;
+static pthread_mutex_t wb_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wb_work_cond = PTHREAD_COND_INITIALIZER;	/* new work for the workers */
+static pthread_cond_t wb_done_cond = PTHREAD_COND_INITIALIZER;	/* an upload has finished */
+static pthread_t *workers = NULL;
+static unsigned int num_workers = 0;
+static int wb_stop = 0;
+
+/* what each worker is uploading right now, for writeback_report() */
+typedef struct {
+  char *fs_path;
+  progress_t progress;
+} worker_state_t;
+static worker_state_t *worker_state = NULL;
+
+/* All uploads draw from one bucket of tokens, one per byte, that fills
+   at upload_rate per second and holds at most a second's worth, so they
+   share the bandwidth however many of them are running. */
+static curl_off_t upload_rate = 0;	/* bytes/s for all uploads together, 0 is unlimited */
+static double rate_tokens = 0;
+static struct timespec rate_last;
+static pthread_mutex_t rate_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* wait until some of "want" bytes may be sent; returns how many */
+static size_t upload_throttle(size_t want)
+{
+  struct timespec now;
+  double need = upload_rate / 16 + 1;	/* don't send in dribbles */
+  size_t got;
+  if (need > want)
+    need = want;
+  pthread_mutex_lock(&rate_mutex);
+  for (;;) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    rate_tokens += (now.tv_sec - rate_last.tv_sec + (now.tv_nsec - rate_last.tv_nsec) / 1e9) * upload_rate;
+    if (rate_tokens > upload_rate)
+      rate_tokens = upload_rate;
+    rate_last = now;
+    if (rate_tokens >= need)
+      break;
+    useconds_t wait = (need - rate_tokens) * 1000000 / upload_rate + 1;
+    pthread_mutex_unlock(&rate_mutex);
+    usleep(wait);
+    pthread_mutex_lock(&rate_mutex);
+  }
+  got = want < rate_tokens ? want : rate_tokens;
+  rate_tokens -= got;
+  pthread_mutex_unlock(&rate_mutex);
+  return got;
+}
+
+/* state of one upload, shared with the curl callbacks */
+typedef struct {
+  int fd;		/* local copy, read with pread() so we can rewind */
+  off_t pos;
+  progress_t *progress;
+} upload_t;
+
+static size_t upload_read(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+  upload_t *up = (upload_t *)userdata;
+  size_t want = size * nmemb;
+  if (upload_rate)
+    want = upload_throttle(want);
+  ssize_t len = pread(up->fd, ptr, want, up->pos);
+  if (len < 0)
+    return CURL_READFUNC_ABORT;
+  up->pos += len;
+  return len;
+}
+
+/* curl needs to rewind when it retries a request, e.g. after an
+   authentication round trip */
+static int upload_seek(void *userdata, curl_off_t offset, int origin)
+{
+  upload_t *up = (upload_t *)userdata;
+  if (origin != SEEK_SET)
+    return CURL_SEEKFUNC_CANTSEEK;
+  up->pos = offset;
+  return CURL_SEEKFUNC_OK;
+}
+
+static int upload_progress(void *userdata, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+  upload_t *up = (upload_t *)userdata;
+  if (up->progress) {
+    up->progress->sent = ulnow;
+    up->progress->total = ultotal;
+    if (up->progress->cancel)
+      return 1;	/* the file has been removed */
+  }
+  return 0;
+}
+
+/* errors that are worth trying again */
+static int upload_transient(CURLcode ret)
+{
+  switch (ret) {
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_GOT_NOTHING:
+    case CURLE_SSL_CONNECT_ERROR:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* PUT the local copy of "fs_path" to "api_path", streaming it straight
+   from the cache file; returns 0 or -errno */
+int writeback_upload(const char *fs_path, const char *api_path, const char *rev, progress_t *progress)
+{
+  CURLcode ret;
+  int s, attempt;
+  struct stat st;
+  upload_t up;
+  char *url = make_url(url_prefix, api_path, rev);
+  
+  up.fd = open(fs_path + 1 /* skip leading slash */, O_RDONLY);
+  if (up.fd < 0 || fstat(up.fd, &st)) {
+    s = errno;
+    perror("UPLOAD: open");
+    if (up.fd >= 0)
+      close(up.fd);
+    free(url);
+    return -s;
+  }
+  up.progress = progress;
+  
+  /* The API does not accept partial uploads, so a broken connection
+     means starting over; we do that a few times before giving up. */
+  for (attempt = 0; ; attempt++) {
+    status_t *status = xml_status_init();
+    up.pos = 0;
+    
+    /* prepare for uploading the file */
+    CURL *curl = curl_open_file(url, upload_read, &up, xml_status_write, status);
+    curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+    curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, upload_seek);
+    curl_easy_setopt(curl, CURLOPT_SEEKDATA, &up);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, upload_progress);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &up);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    /* big buffers for big files */
+    if (st.st_size > UPLOAD_BUFFER_SIZE / 4)
+      curl_easy_setopt(curl, CURLOPT_UPLOAD_BUFFERSIZE, (long)UPLOAD_BUFFER_SIZE);
+    /* give up on stalled connections instead of hanging forever */
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)UPLOAD_STALL_TIMEOUT);
+    
+    /* need to tell curl about the file size */
+    curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)st.st_size);
+    
+    /* do it! */
+    ret = http_perform(curl);
+    http_close(curl);
+    
+    s = xml_get_status(status);
+    xml_status_destroy(status);
+    
+    if (s || !ret || !upload_transient(ret) || attempt >= UPLOAD_RETRIES || (progress && progress->cancel))
+      break;
+    LOG(LOG_HTTP, LEVEL_WARN, "UPLOAD: curl error %d for %s, retrying\n", ret, url);
+    sleep(1 << attempt);
+  }
+  close(up.fd);
+  
+  if (s) {
+    LOG(LOG_HTTP, LEVEL_ERROR, "UPLOAD: BS status %d for %s\n", s, url);
+    free(url);
+    return -s;
+  }
+  if (ret) {
+    LOG(LOG_HTTP, LEVEL_ERROR, "UPLOAD: curl error %d for %s\n", ret, url);
+    free(url);
+    return -EIO;
+  }
+  free(url);
+  return 0;
+}
+
+static void free_job(job_t *j)
+{
+  free(j->fs_path);
+  free(j->api_path);
+  free(j);
+}
+
+static void free_uploaded(uploaded_t *u)
+{
+  HASH_DEL(uploaded_hash, u);
+  free(u->fs_path);
+  free(u);
+}
+
+/* whether the server still has "md5" for "fs_path" as far as we know,
+   i.e. the last listing we got says so, too */
+static int server_has(const char *fs_path, const char *md5)
+{
+  int ret = 0;
+  attr_t *at = attr_cache_find(fs_path);
+  if (at) {
+    cache_lock();
+    ret = at->md5 && !strcmp(at->md5, md5);
+    cache_unlock();
+  }
+  attr_cache_put(at);
+  return ret;
+}
+
+/* upload one file unless its content has been uploaded before */
+static int process_job(const char *fs_path, const char *api_path, progress_t *progress)
+{
+  char md5[MD5_HEX_LEN + 1];
+  uploaded_t *u, *tmp;
+  time_t now;
+  int ret;
+  
+  if (md5_file(fs_path + 1, md5))
+    return -errno;
+  
+  pthread_mutex_lock(&wb_mutex);
+  HASH_FIND_STR(uploaded_hash, fs_path, u);
+  ret = u && !strcmp(u->md5, md5) && time(NULL) - u->time < UPLOADED_TIMEOUT;
+  pthread_mutex_unlock(&wb_mutex);
+  /* someone else may have committed to the package since */
+  if (ret && server_has(fs_path, md5)) {
+    DEBUG("WRITEBACK: %s is unchanged, skipping upload\n", fs_path);
+    return 0;
+  }
+  
+  DEBUG("WRITEBACK: uploading %s\n", fs_path);
+  if ((ret = writeback_upload(fs_path, api_path, NULL, progress)))
+    return ret;
+  
+  /* this is what the server has now, and the package has a new srcmd5 */
+  prjinfo_invalidate_path(api_path);
+  attr_t *at = attr_cache_find(fs_path);
+  if (at)
+    attr_cache_set_md5(at, md5);
+  attr_cache_put(at);
+  
+  pthread_mutex_lock(&wb_mutex);
+  /* forget about uploads we don't trust anymore */
+  now = time(NULL);
+  HASH_ITER(hh, uploaded_hash, u, tmp) {
+    if (now - u->time >= UPLOADED_TIMEOUT)
+      free_uploaded(u);
+  }
+  HASH_FIND_STR(uploaded_hash, fs_path, u);
+  if (!u) {
+    u = calloc(1, sizeof(uploaded_t));
+    u->fs_path = strdup(fs_path);
+    HASH_ADD_KEYPTR(hh, uploaded_hash, u->fs_path, strlen(u->fs_path), u);
+  }
+  strcpy(u->md5, md5);
+  u->time = now;
+  pthread_mutex_unlock(&wb_mutex);
+  return 0;
+}
+
+/* pick the queued job that is due first; wb_mutex must be held */
+static job_t *next_job(time_t *wake)
+{
+  job_t *j, *tmp, *best = NULL;
+  HASH_ITER(hh, job_hash, j, tmp) {
+    if (j->state == JOB_QUEUED && (!best || j->not_before < best->not_before))
+      best = j;
+  }
+  if (best && best->not_before > time(NULL)) {
+    *wake = best->not_before;
+    return NULL;
+  }
+  *wake = 0;
+  return best;
+}
+
+static void *writeback_worker(void *arg)
+{
+  job_t *j;
+  time_t wake;
+  worker_state_t *ws = (worker_state_t *)arg;
+  
+  pthread_mutex_lock(&wb_mutex);
+  while (!wb_stop || job_hash) {
+    j = next_job(&wake);
+    if (!j) {
+      if (wb_stop && !wake)
+        break;	/* only running or failed jobs left */
+      if (wake) {
+        struct timespec ts = { wake, 0 };
+        pthread_cond_timedwait(&wb_work_cond, &wb_mutex, &ts);
+      }
+      else
+        pthread_cond_wait(&wb_work_cond, &wb_mutex);
+      continue;
+    }
+    
+    j->state = JOB_RUNNING;
+    j->requeued = 0;
+    char *fs_path = strdup(j->fs_path);
+    char *api_path = strdup(j->api_path);
+    ws->fs_path = fs_path;
+    ws->progress.sent = ws->progress.total = 0;
+    ws->progress.cancel = 0;
+    pthread_mutex_unlock(&wb_mutex);
+    
+    /* a write during the upload leaves the file modified, and its flush
+       queues it again */
+    unsigned long gen = attr_cache_generation(fs_path);
+    int ret = process_job(fs_path, api_path, &ws->progress);
+    if (!ret)
+      attr_cache_clear_modified_gen(fs_path, gen);
+    
+    pthread_mutex_lock(&wb_mutex);
+    /* the job may have been cancelled while we were uploading */
+    HASH_FIND_STR(job_hash, fs_path, j);
+    if (j && j->state == JOB_RUNNING) {
+      if (ws->progress.cancel) {
+        /* writeback_cancel() is waiting for us */
+        HASH_DEL(job_hash, j);
+        free_job(j);
+      }
+      else if (j->requeued) {
+        j->state = JOB_QUEUED;
+      }
+      else if (ret) {
+        LOG(LOG_HTTP, LEVEL_ERROR, "WRITEBACK: uploading %s failed: %s\n", fs_path, strerror(-ret));
+        j->state = JOB_FAILED;
+        j->error = -ret;
+      }
+      else {
+        HASH_DEL(job_hash, j);
+        free_job(j);
+      }
+    }
+    ws->fs_path = NULL;
+    free(fs_path);
+    free(api_path);
+    pthread_cond_broadcast(&wb_done_cond);
+  }
+  pthread_mutex_unlock(&wb_mutex);
+  return NULL;
+}
+
+/* schedule the upload of "fs_path" to "api_path"; returns -1 if there are
+   no workers, in which case the caller has to upload it itself */
+int writeback_queue(const char *fs_path, const char *api_path)
+{
+  job_t *j;
+  if (!num_workers)
+    return -1;
+  
+  pthread_mutex_lock(&wb_mutex);
+  HASH_FIND_STR(job_hash, fs_path, j);
+  if (!j) {
+    j = calloc(1, sizeof(job_t));
+    j->fs_path = strdup(fs_path);
+    j->api_path = strdup(api_path);
+    HASH_ADD_KEYPTR(hh, job_hash, j->fs_path, strlen(j->fs_path), j);
+  }
+  if (j->state == JOB_RUNNING)
+    j->requeued = 1;
+  else
+    j->state = JOB_QUEUED;
+  j->not_before = time(NULL) + WRITEBACK_DELAY;
+  pthread_cond_signal(&wb_work_cond);
+  pthread_mutex_unlock(&wb_mutex);
+  return 0;
+}
+
+/* wait until "fs_path" has been uploaded; returns the error of the upload,
+   if any, and forgets about it */
+int writeback_sync(const char *fs_path)
+{
+  job_t *j;
+  int ret = 0;
+  
+  pthread_mutex_lock(&wb_mutex);
+  for (;;) {
+    HASH_FIND_STR(job_hash, fs_path, j);
+    if (!j)
+      break;
+    if (j->state == JOB_FAILED) {
+      ret = -j->error;
+      HASH_DEL(job_hash, j);
+      free_job(j);
+      break;
+    }
+    /* no point in waiting for the debounce timer */
+    if (j->state == JOB_QUEUED && j->not_before > time(NULL)) {
+      j->not_before = time(NULL);
+      pthread_cond_signal(&wb_work_cond);
+    }
+    pthread_cond_wait(&wb_done_cond, &wb_mutex);
+  }
+  pthread_mutex_unlock(&wb_mutex);
+  return ret;
+}
+
+/* the worker uploading "fs_path", if any; wb_mutex must be held */
+static worker_state_t *find_worker(const char *fs_path)
+{
+  unsigned int i;
+  for (i = 0; i < num_workers; i++) {
+    if (worker_state[i].fs_path && !strcmp(worker_state[i].fs_path, fs_path))
+      return &worker_state[i];
+  }
+  return NULL;
+}
+
+/* forget about "fs_path", which has been removed; an upload that is
+   running is aborted, and we wait for it to end, so that it can't put the
+   file back on the server after it has been deleted there */
+void writeback_cancel(const char *fs_path)
+{
+  job_t *j;
+  uploaded_t *u;
+  worker_state_t *ws;
+  pthread_mutex_lock(&wb_mutex);
+  while ((ws = find_worker(fs_path))) {
+    ws->progress.cancel = 1;
+    pthread_cond_wait(&wb_done_cond, &wb_mutex);
+  }
+  HASH_FIND_STR(job_hash, fs_path, j);
+  if (j) {
+    HASH_DEL(job_hash, j);
+    free_job(j);
+  }
+  HASH_FIND_STR(uploaded_hash, fs_path, u);
+  if (u)
+    free_uploaded(u);
+  pthread_cond_broadcast(&wb_done_cond);
+  pthread_mutex_unlock(&wb_mutex);
+}
+
+/* write a human-readable list of pending and failed uploads to "fp" */
+void writeback_report(FILE *fp)
+{
+  static const char *state_name[] = { "queued", "uploading", "failed" };
+  job_t *j, *tmp;
+  pthread_mutex_lock(&wb_mutex);
+  HASH_ITER(hh, job_hash, j, tmp) {
+    fprintf(fp, "%-9s %s", state_name[j->state], j->fs_path);
+    if (j->state == JOB_FAILED)
+      fprintf(fp, ": %s", strerror(j->error));
+    worker_state_t *ws = j->state == JOB_RUNNING ? find_worker(j->fs_path) : NULL;
+    if (ws && ws->progress.total)
+      fprintf(fp, " (%lld/%lld bytes)", (long long)ws->progress.sent, (long long)ws->progress.total);
+    fputc('\n', fp);
+  }
+  pthread_mutex_unlock(&wb_mutex);
+}
+
+/* start "threads" upload workers; with no workers, files are uploaded
+   synchronously when they are flushed; "rate" limits the bandwidth used
+   by all uploads together, in KB/s */
+void writeback_init(unsigned int threads, unsigned int rate)
+{
+  unsigned int i;
+  upload_rate = (curl_off_t)rate * 1024;
+  clock_gettime(CLOCK_MONOTONIC, &rate_last);
+  num_workers = threads;
+  if (!num_workers)
+    return;
+  workers = calloc(num_workers, sizeof(pthread_t));
+  worker_state = calloc(num_workers, sizeof(worker_state_t));
+  for (i = 0; i < num_workers; i++) {
+    if (pthread_create(&workers[i], NULL, writeback_worker, &worker_state[i])) {
+      perror("pthread_create");
+      abort();
+    }
+  }
+}
+
+/* upload everything that is still queued and stop the workers */
+void writeback_destroy(void)
+{
+  unsigned int i;
+  job_t *j, *tmp;
+  uploaded_t *u, *utmp;
+  
+  if (!num_workers)
+    return;
+  
+  pthread_mutex_lock(&wb_mutex);
+  wb_stop = 1;
+  HASH_ITER(hh, job_hash, j, tmp) {
+    j->not_before = 0;
+  }
+  pthread_cond_broadcast(&wb_work_cond);
+  pthread_mutex_unlock(&wb_mutex);
+  for (i = 0; i < num_workers; i++)
+    pthread_join(workers[i], NULL);
+  free(workers);
+  free(worker_state);
+  num_workers = 0;
+  
+  HASH_ITER(hh, job_hash, j, tmp) {
+    LOG(LOG_HTTP, LEVEL_ERROR, "WRITEBACK: %s was not uploaded: %s\n", j->fs_path, strerror(j->error));
+    HASH_DEL(job_hash, j);
+    free_job(j);
+  }
+  HASH_ITER(hh, uploaded_hash, u, utmp) {
+    free_uploaded(u);
+  }
+}
@@ -0,0 +1,44 @@
+/*
+ * writeback.h
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <curl/curl.h>
+
+/* asynchronous write-back
+   Modified files are uploaded by a pool of worker threads, so that close()
+   does not have to wait for the server.  Repeated flushes of the same file
+   are merged, and content that has already been uploaded is skipped. */
+
+/* upload progress */
+typedef struct {
+  curl_off_t sent;
+  curl_off_t total;
+  volatile int cancel;	/* set to abort the upload */
+} progress_t;
+
+void writeback_init(unsigned int threads, unsigned int rate);
+void writeback_destroy(void);
+
+int writeback_upload(const char *fs_path, const char *api_path, const char *rev, progress_t *progress);
+
+int writeback_queue(const char *fs_path, const char *api_path);
+int writeback_sync(const char *fs_path);
+void writeback_cancel(const char *fs_path);
+void writeback_report(FILE *fp);
@@ -0,0 +1,381 @@
+/*
+ * zcache.c
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "zcache.h"
+#include "obsfs.h"
+#include "util.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zstd.h>
+
+#define ZCACHE_DEBUG
+
+#ifdef ZCACHE_DEBUG
+#define DEBUG(x...) LOG(LOG_CACHE, LEVEL_DEBUG, x)
+#else
+#define DEBUG(x...)
+#endif
+
+static zfile_t *zfile_hash = NULL;
+static pthread_mutex_t zcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_zfile(zfile_t *z)
+{
+  close(z->fd);
+  pthread_mutex_destroy(&z->mutex);
+  free(z->path);
+  free(z->frames);
+  free(z->pending);
+  free(z->frame);
+  free(z);
+}
+
+static void remove_locked(zfile_t *z)
+{
+  HASH_DEL(zfile_hash, z);
+  if (z->refs)
+    z->removed = 1;
+  else
+    free_zfile(z);
+}
+
+void zcache_free(void)
+{
+  zfile_t *z, *tmp;
+  pthread_mutex_lock(&zcache_mutex);
+  HASH_ITER(hh, zfile_hash, z, tmp) {
+    remove_locked(z);
+  }
+  pthread_mutex_unlock(&zcache_mutex);
+}
+
+/* Is it worth compressing something that starts like this? */
+int zcache_is_text(const char *data, size_t len)
+{
+  return len && !memchr(data, 0, min(len, 4096));
+}
+
+/* start a compressed cache file for "path"; "fd" is the (empty) cache file */
+zfile_t *zcache_create(const char *path, int fd)
+{
+  zfile_t *z = calloc(1, sizeof(zfile_t));
+  z->path = strdup(path);
+  z->fd = dup(fd);
+  z->frames = malloc(sizeof(off_t));
+  z->frames[0] = 0;
+  z->frame_num = -1;
+  z->refs = 1;
+  pthread_mutex_init(&z->mutex, NULL);
+  
+  pthread_mutex_lock(&zcache_mutex);
+  zfile_t *old;
+  HASH_FIND_STR(zfile_hash, path, old);
+  if (old)
+    remove_locked(old);
+  HASH_ADD_KEYPTR(hh, zfile_hash, z->path, strlen(z->path), z);
+  pthread_mutex_unlock(&zcache_mutex);
+  DEBUG("ZCACHE: compressing %s\n", path);
+  return z;
+}
+
+/* find the compressed cache file for "path" and take a reference to it;
+   returns NULL if "path" is not stored compressed */
+zfile_t *zcache_get(const char *path)
+{
+  zfile_t *z;
+  pthread_mutex_lock(&zcache_mutex);
+  HASH_FIND_STR(zfile_hash, path, z);
+  if (z)
+    z->refs++;
+  pthread_mutex_unlock(&zcache_mutex);
+  return z;
+}
+
+void zcache_release(zfile_t *z)
+{
+  pthread_mutex_lock(&zcache_mutex);
+  if (!--z->refs && z->removed)
+    free_zfile(z);
+  pthread_mutex_unlock(&zcache_mutex);
+}
+
+/* compress "len" bytes and write them as a new frame; z->mutex must be held */
+static int write_frame(zfile_t *z, const char *data, size_t len)
+{
+  size_t bound = ZSTD_compressBound(len);
+  char *buf = malloc(bound);
+  size_t clen = ZSTD_compress(buf, bound, data, len, ZCACHE_LEVEL);
+  if (ZSTD_isError(clen)) {
+    DEBUG("ZCACHE: compressing %s failed: %s\n", z->path, ZSTD_getErrorName(clen));
+    free(buf);
+    return -1;
+  }
+  off_t end = z->frames[z->num_frames];
+  if (pwrite(z->fd, buf, clen, end) != clen) {
+    free(buf);
+    return -1;
+  }
+  free(buf);
+  z->frames = realloc(z->frames, (z->num_frames + 2) * sizeof(off_t));
+  z->frames[++z->num_frames] = end + clen;
+  return 0;
+}
+
+/* decompress frame "n" into z->frame; z->mutex must be held */
+static int load_frame(zfile_t *z, int n)
+{
+  if (z->frame_num == n)
+    return 0;
+  size_t clen = z->frames[n + 1] - z->frames[n];
+  char *buf = malloc(clen);
+  if (pread(z->fd, buf, clen, z->frames[n]) != clen) {
+    free(buf);
+    return -1;
+  }
+  if (!z->frame)
+    z->frame = malloc(ZCACHE_FRAME_SIZE);
+  size_t len = ZSTD_decompress(z->frame, ZCACHE_FRAME_SIZE, buf, clen);
+  free(buf);
+  if (ZSTD_isError(len)) {
+    DEBUG("ZCACHE: decompressing %s failed: %s\n", z->path, ZSTD_getErrorName(len));
+    z->frame_num = -1;
+    return -1;
+  }
+  z->frame_num = n;
+  return 0;
+}
+
+/* uncompressed size of frame "n"; all frames but the last one are full */
+static size_t frame_len(zfile_t *z, int n)
+{
+  if (n < z->num_frames - 1)
+    return ZCACHE_FRAME_SIZE;
+  return z->size - z->pending_len - (off_t)n * ZCACHE_FRAME_SIZE;
+}
+
+/* drop the frames from "n" on; z->mutex must be held */
+static int cut_frames(zfile_t *z, int n)
+{
+  if (ftruncate(z->fd, z->frames[n]))
+    return -1;
+  z->num_frames = n;
+  if (z->frame_num >= n)
+    z->frame_num = -1;
+  return 0;
+}
+
+/* add data at the end of a compressed file */
+int zcache_append(zfile_t *z, const char *data, size_t len)
+{
+  int ret = 0;
+  pthread_mutex_lock(&z->mutex);
+  
+  /* a short last frame (left by zcache_flush()) has to be filled up first */
+  if (!z->pending_len && z->num_frames && z->size % ZCACHE_FRAME_SIZE) {
+    int last = z->num_frames - 1;
+    size_t last_len = frame_len(z, last);
+    if (load_frame(z, last) || cut_frames(z, last)) {
+      pthread_mutex_unlock(&z->mutex);
+      return -1;
+    }
+    z->pending = malloc(ZCACHE_FRAME_SIZE);
+    memcpy(z->pending, z->frame, last_len);
+    z->pending_len = last_len;
+  }
+  
+  while (len) {
+    if (!z->pending)
+      z->pending = malloc(ZCACHE_FRAME_SIZE);
+    size_t n = min(len, ZCACHE_FRAME_SIZE - z->pending_len);
+    memcpy(z->pending + z->pending_len, data, n);
+    z->pending_len += n;
+    z->size += n;
+    data += n;
+    len -= n;
+    if (z->pending_len == ZCACHE_FRAME_SIZE) {
+      if (write_frame(z, z->pending, z->pending_len)) {
+        z->size -= z->pending_len;
+        z->pending_len = 0;
+        ret = -1;
+        break;
+      }
+      z->pending_len = 0;
+    }
+  }
+  pthread_mutex_unlock(&z->mutex);
+  return ret;
+}
+
+/* write out data that doesn't fill a frame yet; we don't want to keep it in
+   memory for every file in the cache */
+int zcache_flush(zfile_t *z)
+{
+  int ret = 0;
+  pthread_mutex_lock(&z->mutex);
+  if (z->pending_len) {
+    ret = write_frame(z, z->pending, z->pending_len);
+    if (ret)
+      z->size -= z->pending_len;
+    z->pending_len = 0;
+  }
+  free(z->pending);
+  z->pending = NULL;
+  pthread_mutex_unlock(&z->mutex);
+  return ret;
+}
+
+ssize_t zcache_pread(zfile_t *z, char *buf, size_t size, off_t offset)
+{
+  ssize_t done = 0;
+  pthread_mutex_lock(&z->mutex);
+  off_t flushed = z->size - z->pending_len;
+  while (size && offset < z->size) {
+    size_t n;
+    if (offset >= flushed) {
+      /* not compressed yet */
+      n = min(size, z->size - offset);
+      memcpy(buf, z->pending + (offset - flushed), n);
+    }
+    else {
+      int f = offset / ZCACHE_FRAME_SIZE;
+      size_t in_frame = offset % ZCACHE_FRAME_SIZE;
+      if (load_frame(z, f)) {
+        pthread_mutex_unlock(&z->mutex);
+        return done ? done : -EIO;
+      }
+      n = min(size, frame_len(z, f) - in_frame);
+      memcpy(buf, z->frame + in_frame, n);
+    }
+    buf += n;
+    offset += n;
+    size -= n;
+    done += n;
+  }
+  pthread_mutex_unlock(&z->mutex);
+  return done;
+}
+
+/* cut a compressed file down to "len" bytes */
+int zcache_truncate(zfile_t *z, off_t len)
+{
+  int ret = 0;
+  pthread_mutex_lock(&z->mutex);
+  if (len >= z->size) {
+    pthread_mutex_unlock(&z->mutex);
+    return len == z->size ? 0 : -1;
+  }
+  off_t flushed = z->size - z->pending_len;
+  if (len >= flushed) {
+    z->pending_len = len - flushed;
+  }
+  else {
+    /* keep the beginning of the frame "len" is in */
+    int f = len / ZCACHE_FRAME_SIZE;
+    size_t keep = len % ZCACHE_FRAME_SIZE;
+    if ((keep && load_frame(z, f)) || cut_frames(z, f)) {
+      pthread_mutex_unlock(&z->mutex);
+      return -1;
+    }
+    if (!z->pending)
+      z->pending = malloc(ZCACHE_FRAME_SIZE);
+    if (keep)
+      memcpy(z->pending, z->frame, keep);
+    z->pending_len = keep;
+    z->frame_num = -1;
+  }
+  z->size = len;
+  pthread_mutex_unlock(&z->mutex);
+  return ret;
+}
+
+/* replace the compressed cache file of "path" with a plain one, because
+   somebody wants to modify it; returns 0 if there was nothing to do */
+int zcache_expand(const char *path)
+{
+  zfile_t *z;
+  int ret = 0;
+  pthread_mutex_lock(&zcache_mutex);
+  HASH_FIND_STR(zfile_hash, path, z);
+  if (!z) {
+    pthread_mutex_unlock(&zcache_mutex);
+    return 0;
+  }
+  DEBUG("ZCACHE: expanding %s\n", path);
+  const char *relpath = path + 1;	/* skip leading slash */
+  char *tmppath = malloc(strlen(relpath) + strlen(".expand") + 1);
+  sprintf(tmppath, "%s.expand", relpath);
+  int fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    ret = -1;
+  else {
+    char *buf = malloc(ZCACHE_FRAME_SIZE);
+    off_t offset = 0;
+    ssize_t n;
+    while ((n = zcache_pread(z, buf, ZCACHE_FRAME_SIZE, offset)) > 0) {
+      if (write(fd, buf, n) != n)
+        break;
+      offset += n;
+    }
+    free(buf);
+    close(fd);
+    if (offset != z->size || rename(tmppath, relpath)) {
+      unlink(tmppath);
+      ret = -1;
+    }
+  }
+  free(tmppath);
+  if (!ret)
+    remove_locked(z);
+  pthread_mutex_unlock(&zcache_mutex);
+  return ret;
+}
+
+/* forget about the compressed cache file of "path", if any */
+void zcache_remove(const char *path)
+{
+  zfile_t *z;
+  pthread_mutex_lock(&zcache_mutex);
+  HASH_FIND_STR(zfile_hash, path, z);
+  if (z)
+    remove_locked(z);
+  pthread_mutex_unlock(&zcache_mutex);
+}
+
+/* get the uncompressed size of a compressed cache file; returns -1 if
+   "path" is not stored compressed */
+int zcache_size(const char *path, off_t *size)
+{
+  zfile_t *z;
+  pthread_mutex_lock(&zcache_mutex);
+  HASH_FIND_STR(zfile_hash, path, z);
+  if (z) {
+    pthread_mutex_lock(&z->mutex);
+    *size = z->size;
+    pthread_mutex_unlock(&z->mutex);
+  }
+  pthread_mutex_unlock(&zcache_mutex);
+  return z ? 0 : -1;
+}
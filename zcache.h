@@ -0,0 +1,60 @@
+/*
+ * zcache.h
+ * (c) 2010 Ulrich Hecht, SuSE Linux Products GmbH <uli@suse.de>
+ *
+ * This file is part of obsfs.
+ *
+ * obsfs is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 2 or version 3 of the License.
+ *
+ * obsfs is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with obsfs.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include "uthash.h"
+
+/* compressed file cache
+   Text files we only read, build logs in particular, are stored in the file
+   cache as a sequence of independent zstd frames of ZCACHE_FRAME_SIZE bytes
+   each.  The offsets of the frames are kept in memory, so a read only has to
+   decompress the frames it touches. */
+
+typedef struct zfile_s {
+  char *path;
+  int fd;		/* cache file */
+  off_t size;		/* uncompressed size */
+  off_t *frames;	/* start of each frame in the cache file, and the end of the last one */
+  int num_frames;
+  char *pending;	/* data past the last frame, not yet compressed */
+  size_t pending_len;
+  char *frame;		/* the frame we have decompressed last... */
+  int frame_num;	/* ...and its number, -1 if none */
+  int refs;
+  int removed;		/* no longer in the cache, free when released */
+  pthread_mutex_t mutex;
+  UT_hash_handle hh;
+} zfile_t;
+
+void zcache_free(void);
+int zcache_is_text(const char *data, size_t len);
+
+zfile_t *zcache_create(const char *path, int fd);
+zfile_t *zcache_get(const char *path);
+void zcache_release(zfile_t *z);
+int zcache_append(zfile_t *z, const char *data, size_t len);
+int zcache_flush(zfile_t *z);
+ssize_t zcache_pread(zfile_t *z, char *buf, size_t size, off_t offset);
+int zcache_truncate(zfile_t *z, off_t len);
+int zcache_expand(const char *path);
+void zcache_remove(const char *path);
+int zcache_size(const char *path, off_t *size);